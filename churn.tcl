@@ -0,0 +1,58 @@
+#! /usr/bin/env expect
+
+proc churn {directory} {
+
+    cd $directory
+
+    if { [catch {set result [exec {*}[eval list {mkdir "churn"}]]} reason] } {
+
+    puts "Failed execution: $reason"
+
+    } else {
+
+    puts $result
+
+    }
+
+    cd "churn"
+
+# each round writes most of the 5 MB test disk and deletes it again, so every
+# round after the first only succeeds if the previous one gave its blocks back
+    set file_size [expr {3 * 1024 * 1024}]
+    set rounds 20
+    set failed 0
+
+    puts "\nExecuting: $rounds rounds of write [expr {$file_size / 1024}] KB file 'churn.bin' and delete it\n"
+
+    set start [clock microseconds]
+
+    for {set i 1} {$i <= $rounds} {incr i} {
+
+        if { [catch {set result [exec dd if=/dev/zero of=churn.bin bs=4k count=[expr {$file_size / 4096}] 2>@1]} reason] } {
+
+        puts "Failed execution in round $i: $reason"
+        incr failed
+
+        }
+
+        if { [catch {set result [exec rm churn.bin]} reason] } {
+
+        puts "Failed execution in round $i: $reason"
+        incr failed
+
+        }
+    }
+
+    set elapsed [expr {max([clock microseconds] - $start, 1)}]
+    puts [format "%d rounds, %d failed: %.1f ms per round" $rounds $failed [expr {$elapsed / 1000.0 / $rounds}]]
+
+    cd {..}
+
+    if { [catch {set result [exec rmdir "churn"]} reason] } {
+
+    puts "Failed execution: $reason"
+
+    }
+
+    cd {..}
+}
@@ -11,9 +11,9 @@ if { [catch {set result [exec rm .disk]} reason] } {
 
 }
 
-if { [catch {set result [exec dd bs=1K count=5K if=/dev/zero of=.disk]} reason] } {
+if { [catch {set result [exec ./mkfs.cs1550 -s 5M .disk]} reason] } {
 
-#puts "Failed exec dd bs=1K count=5K if=/dev/zero of=.disk:\n$reason"
+#puts "Failed exec ./mkfs.cs1550 -s 5M .disk:\n$reason"
 #exit -2
 
 } else {
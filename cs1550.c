@@ -14,6 +14,9 @@
 #define FUSE_USE_VERSION 26
 
 #include <fuse.h>
+#ifdef CS1550_LOWLEVEL
+#include <fuse_lowlevel.h>
+#endif
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
@@ -21,6 +24,26 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "cs1550.h"
+
+#if defined(__SSE2__) && !defined(CS1550_NO_SIMD)
+#include <emmintrin.h>
+#define CS1550_SIMD
+#endif
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
 
 #ifndef _DEBUG
 #define _DEBUG
@@ -32,1211 +55,6016 @@
 #define print_debug(s) do {} while (0)
 #endif
 
+// anything in the dirty map waiting for write-back; only touched with the instance's dirty_lock held
 static int dirty = false;
 
-//size of a disk block
-#define    BLOCK_SIZE 512
-
-//we'll use 8.3 filenames
-#define    MAX_FILENAME 8
-#define    MAX_EXTENSION 3
+/**
+ * Scans the bitmap 64 bits at a time for the first clear bit.
+ *
+ * @param bitmap pointer to a bitmap, readable in whole 64-bit words up to end
+ * @param start first bit to look at
+ * @param end one past the last bit to look at
+ * @return the first clear bit in [start, end), -1 if there is none
+ */
+long bitmap_find_zero(const char *bitmap, long start, long end);
 
-//How many files can there be in one directory?
-#define MAX_FILES_IN_DIR (BLOCK_SIZE - sizeof(int)) / ((MAX_FILENAME + 1) + (MAX_EXTENSION + 1) + sizeof(size_t) + sizeof(long))
+/**
+ * Scans the bitmap 64 bits at a time for the first set bit.
+ *
+ * @return the first set bit in [start, end), end if there is none
+ */
+long bitmap_find_one(const char *bitmap, long start, long end);
 
 /**
  *
- * @param bitmap pointer to a bitmap
- * @return the first location of a free pointer
+ * @param count how many clear bits in a row are needed
+ * @return the first bit of the first run of count clear bits in [start, end), -1 if there is none
  */
-long get_free_block(char *bitmap);
+long bitmap_find_zero_run(const char *bitmap, long start, long end, long count);
 
 /**
+ * Marks a range of blocks as used or free. One bit stands for one block.
  *
  * @param offset the offset from the start of the bitmap
  * @param length the length of the bits to set
- * @param value the value to set. usually 1.
+ * @param value the value to set. 1 to mark used, 0 to mark free.
  * @param bitmap pointer to a bitmap
  */
 void set_bit_map(long offset, long length, char value, char *bitmap);
 
-void print_bit_map(int offset, int length, char *bitmap);
+/**
+ * Sets every bit in [start, end). The middle of the range is filled a byte and then a 64-bit word at a time.
+ */
+void bitmap_set_range(char *bitmap, long start, long end);
 
 /**
- *
- * @param src string
- * @param dest string
- * @param start_position index to start
- * @param length total length to copy from src to dest
+ * Clears every bit in [start, end). The middle of the range is cleared a byte and then a 64-bit word at a time.
  */
-void substring(const char *src, char **dest, int start_position, int length);
+void bitmap_clear_range(char *bitmap, long start, long end);
 
 /**
  *
- * @param path the full path information
- * @param dir_name a pointer to a pointer
- * @param full_file_name a pointer to a pointer
- * @param file_name a pointer to a pointer
- * @param extension_name a pointer to a pointer
- * @return:     0 on success
- *      -ENAMETOOLONG if the name is beyond 8.3 chars
- *      -EPERM if the file is trying to be created in the root dir
- *      -EEXIST if the file already exists
+ * @return how many bits in [start, end) are set
  */
-int get_path_info_for_mknod(const char *path, char **dir_name, char **full_file_name, char **file_name,
-                            char **extension_name);
+long bitmap_count(const char *bitmap, long start, long end);
+
+void print_bit_map(int offset, int length, char *bitmap);
+
+// a piece of a path: points into the path itself rather than holding a copy, so it isn't nul-terminated
+struct path_view {
+    const char *start;
+    int length;
+};
+
+// a path split into the parts the file system cares about
+struct path_info {
+    struct path_view parent;    //the path up to its last name, e.g. "/a/b" for "/a/b/c.txt"; empty for the root
+    struct path_view last;      //the last name, empty for "/"
+    int components;             //how many names the path has, 0 for "/"
+};
 
 /**
+ * Splits path into views of its parent directory and last name in one pass, without allocating.
  *
  * @param path the full path information
- * @param dir_name a pointer to a pointer
- * @param full_file_name a pointer to a pointer, is empty string if no file
- * @param file_name a pointer to a pointer, is empty string if no file
- * @param extension_name a pointer to a pointer, is empty string if no file
- */
-void get_path_info(const char *path, char **dir_name, char **full_file_name, char **file_name,
-                   char **extension_name);
-
-
-//The attribute packed means to not align these things
-struct cs1550_directory_entry {
-    int nFiles;    //How many files are in this directory.
-    //Needs to be less than MAX_FILES_IN_DIR
-
-    struct cs1550_file_directory {
-        char fname[MAX_FILENAME + 1];    //filename (plus space for nul)
-        char fext[MAX_EXTENSION + 1];    //extension (plus space for nul)
-        size_t fsize;                    //file size
-        long nStartBlock;                //where the first block is on disk
-    } __attribute__((packed)) files[MAX_FILES_IN_DIR];    //There is an array of these
-
-    //This is some space to get this to be exactly the size of the disk block.
-    //Don't use it for anything.
-    char padding[BLOCK_SIZE - MAX_FILES_IN_DIR * sizeof(struct cs1550_file_directory) - sizeof(int)];
-};
-
-typedef struct cs1550_root_directory cs1550_root_directory;
+ * @param info filled in with views into path
+ */
+void parse_path(const char *path, struct path_info *info);
 
-#define MAX_DIRS_IN_ROOT (BLOCK_SIZE - sizeof(int)) / ((MAX_FILENAME + 1) + sizeof(long))
 
-struct cs1550_root_directory {
-    int nDirectories;    //How many subdirectories are in the root
-    //Needs to be less than MAX_DIRS_IN_ROOT
-    struct cs1550_directory {
-        char dname[MAX_FILENAME + 1];    //directory name (plus space for nul)
-        long nStartBlock;                //where the directory block is on disk
-    } __attribute__((packed)) directories[MAX_DIRS_IN_ROOT];    //There is an array of these
 
-    //This is some space to get this to be exactly the size of the disk block.
-    //Don't use it for anything.
-    char padding[BLOCK_SIZE - MAX_DIRS_IN_ROOT * sizeof(struct cs1550_directory) - sizeof(int)];
+// information about the mapped image, taken from its superblock at mount
+struct cs1550_disk {
+    char *image;                        //the whole image, mapped
+    size_t size;                        //bytes mapped
+    size_t block_size;
+    long block_count;
+    char *bitmap;                       //the bitmap blocks inside the mapping
+    long root_block;
+    struct cs1550_superblock *super;    //block 0 inside the mapping
 };
 
+typedef struct cs1550_disk cs1550_disk;
 
-typedef struct cs1550_directory_entry cs1550_directory_entry;
+/*
+ * A file's slot says where its entry is: the directory block holding it, which needn't be the first block of its
+ * directory, and its place in that block. Going from a slot to the entry never walks a directory.
+ */
+#define SLOT_INDEX_BITS 16    //more than the entries of the biggest block
 
-//How much data can one block hold?
-#define    MAX_DATA_IN_BLOCK (BLOCK_SIZE)
+static inline long make_slot(long block, long index) {
+    return block << SLOT_INDEX_BITS | index;
+}
 
-struct cs1550_disk_block {
-    //All of the space in the block can be used for actual data
-    //storage.
-    char data[MAX_DATA_IN_BLOCK]; // 512 * 1 byte
-};
+static inline long slot_block(long slot) {
+    return slot >> SLOT_INDEX_BITS;
+}
 
-typedef struct cs1550_disk_block cs1550_disk_block;
+static inline long slot_index(long slot) {
+    return slot & ((1L << SLOT_INDEX_BITS) - 1);
+}
 
-// we need to keep track of the disk by using a bitmap
-// size is 5*2^20 for 5 mb or 5242880 bytes
-#define SIZE_OF_DISK 5242880
-#define BIT_MAP_SIZE 655360
-#define NUMBER_OF_BLOCKS ((SIZE_OF_DISK - (BIT_MAP_SIZE)) / BLOCK_SIZE)
-// need to get disk size in bytes on init
-// information
-struct cs1550_disk {
-    cs1550_disk_block blocks[NUMBER_OF_BLOCKS];
-    // reserve 5242880 bytes - (5242880 bits or 655360 bytes)
-    // or 4587520 bytes / 512 bytes per block = 8960 blocks
+/*
+ * The root's inode number; every other directory and file gets the next one of a counter when it's created and
+ * keeps it, on the image too, for as long as it is there. See struct inode_table.
+ */
+#define ROOT_INODE 1    //FUSE_ROOT_ID, which only fuse_lowlevel.h defines
 
-    char bitmap[BIT_MAP_SIZE]; // 655360 bytes for 8960 blocks this is 1 byte == 8 bits
-};
+/*
+ * @return where block n starts inside the mapping
+ */
+static inline char *block_address(cs1550_disk *disk, long n) {
+    assert(n >= 0 && n < disk->block_count);
+    return disk->image + n * (long) disk->block_size;
+}
 
-typedef struct cs1550_disk cs1550_disk;
+/*
+ * @return the block after block in its directory (or the root), 0 if it's the last
+ */
+static inline long next_directory_block(cs1550_disk *disk, long block) {
+    return DIRECTORY_CHAIN(disk, block_address(disk, block))->nNext;
+}
 
-/**
- *
- * @param disk a pointer to the disk
- * @return EXIT_SUCCESS
- *      -EBADF if ".disk" can't be opened
+/*
+ * @return the last block of the directory (or the root) whose first block is head
  */
-int write_to_disk(cs1550_disk *disk);
+static inline long last_directory_block(cs1550_disk *disk, long head) {
+    long last = DIRECTORY_CHAIN(disk, block_address(disk, head))->nPrev;
+    return last != 0 ? last : head;
+}
 
-struct Singleton {
-    cs1550_disk *d;
-};
+/*
+ * @return the first block of the directory block is part of
+ */
+static inline long first_directory_block(cs1550_disk *disk, long block) {
+    long head = DIRECTORY_CHAIN(disk, block_address(disk, block))->nHead;
+    return head != 0 ? head : block;
+}
 
-typedef struct Singleton *singleton;
+/*
+ * @return the entry of the file in slot
+ */
+static inline struct cs1550_file_directory *slot_file(cs1550_disk *disk, long slot) {
+    return &((cs1550_directory_entry *) block_address(disk, slot_block(slot)))->files[slot_index(slot)];
+}
 
-struct Singleton *get_instance(void);
+/*
+ * @param dir_block block of the directory, or of the directory holding the file; 0 for the root
+ * @param slot slot of the file, -1 for the directory itself
+ * @return the inode number and times of the directory or file
+ */
+static inline struct cs1550_attributes *entry_attributes(cs1550_disk *disk, long dir_block, long slot) {
+    if (slot == -1) {
+        return DIRECTORY_ATTRIBUTES(disk, block_address(disk, dir_block != 0 ? dir_block : disk->root_block));
+    }
+    return FILE_ATTRIBUTES(disk, block_address(disk, slot_block(slot)), slot_index(slot));
+}
 
 /**
+ * Writes a superblock, an empty bitmap and an empty root directory into the mapping.
  *
- * By using a singleton to wrap our disk access we can be sure that we are accessing the most up-to-date information.
- *
- * Every time we read we check first to see that we don't need to write by using a global 'dirty' flag.
+ * @param disk the mapped image, with image and size filled in
+ * @param block_size bytes per block
+ * @return EXIT_SUCCESS, or what layout_disk() returned
+ */
+int format_disk(cs1550_disk *disk, size_t block_size);
+
+/**
  *
- * Upon the init the disk is asserted to not be dirty.
+ * @param disk pointer to the disk
+ * @return the first location of a free pointer, disk->block_count if the disk is full
+ */
+long get_free_block(cs1550_disk *disk);
+
+/**
+ * Tells the allocator that blocks from offset on may have become free, so its search hint moves back if needed.
  *
- * @return pointer to singleton
+ * @param offset the first block that was freed
  */
-struct Singleton *get_instance(void) {
-    static singleton instance = NULL;
+void release_free_blocks(long offset);
 
-//    pthread_mutex_lock(&instance_mutex);
+/**
+ *
+ * @param disk pointer to the disk
+ * @param count how many free bits in a row are needed
+ * @return the first location of count free bits in a row, -1 if there is no such run
+ */
+long get_free_run(cs1550_disk *disk, long count);
 
-    if (instance == NULL) {
+/**
+ * Sets blocks aside for a write buffer by taking them off free_blocks, so no allocation can use them until they are
+ * given back with unreserve_free_blocks(). The allocator's lock is taken here.
+ *
+ * @param count how many blocks are wanted
+ * @param partial true to set aside as many as are free when that is fewer than count, false to set aside none then
+ * @return how many blocks were set aside
+ */
+long reserve_free_blocks(long count, int partial);
 
-        // get map for struct
-        instance = (singleton) calloc(1, sizeof(struct Singleton));
+/**
+ * Gives blocks that reserve_free_blocks() set aside back. The allocator's lock is taken here.
+ */
+void unreserve_free_blocks(long count);
 
-        print_debug(("Calloc instance\n"));
-        instance->d = (cs1550_disk *) calloc(1, sizeof(struct cs1550_disk));
+/**
+ * Hands out a block for a new directory, from the pool mkfs set aside if any is left, else from the bitmap.
+ *
+ * @param disk pointer to the disk
+ * @return the block, already marked used, -1 if the disk is full
+ */
+long get_directory_block(cs1550_disk *disk);
 
-        assert(dirty == false);
+// walks the extents of a file in order: the inline one first, then the extent block chain
+struct extent_iterator {
+    int started;
+    long block;
+    int index;
+};
 
-        print_debug(("Opening disk for read\n"));
-        FILE *filePtr = fopen(".disk", "rb");
-        if (filePtr == NULL) {
-            exit(-EBADF);
-        }
+// an extent of a file found earlier, so the next copy can start looking there instead of at the first extent
+struct extent_cursor {
+    struct extent_iterator it;    //iterator as it was just before it returned that extent
+    off_t position;               //offset in the file where the extent starts
+};
 
-        fread(instance->d, sizeof(struct cs1550_disk), 1, filePtr);
-        print_debug(("Closed disk for read in get_instance\n"));
-        fclose(filePtr);
+/**
+ *
+ * @param disk a pointer to the disk
+ * @param file the file whose extents are walked
+ * @param it iterator, zeroed before the first call
+ * @param start set to the first block of the next extent
+ * @param count set to the number of blocks in the next extent
+ * @return true if there was another extent
+ */
+int next_extent(cs1550_disk *disk, const struct cs1550_file_directory *file, struct extent_iterator *it,
+                long *start, long *count);
 
-        // todo: implement variable size disk
-//        // get disk size
-        struct stat st;
-        stat(".disk", &st);
-        off_t size = st.st_size;
-        print_debug(("disk size: %ld\n", (long) size));
-        print_debug(("size of struct cs1550_disk: %ld\n", sizeof(struct cs1550_disk)));
-        print_debug(("max directories = %ld\n", MAX_DIRS_IN_ROOT));
-        print_debug(("max files in dir = %ld\n", MAX_FILES_IN_DIR));
+/**
+ * Makes sure file has blocks for size bytes and sets its size. The last extent is grown in place when the blocks
+ * behind it are free; otherwise a new extent is added.
+ *
+ * @param disk a pointer to the disk
+ * @param entry the directory block holding file
+ * @param file the file to grow
+ * @param size the new file size
+ * @return 0 on success
+ *      -ENOSPC if there aren't enough free blocks
+ */
+int grow_file(cs1550_disk *disk, cs1550_directory_entry *entry, struct cs1550_file_directory *file, size_t size);
 
-//        // get map for disk
-//        instance->d = (cs1550_disk *) calloc(1, (size_t) size);
-//
-//        print_debug(("size of blocks: %ld\n", (long) (size - (size >> 3)) >> 9));
-//        print_debug(("size of bitmap: %ld\n", (long) size >> 3));
-//
-//        // Example is size is 5MB or 5242880 bytes
-//        // I need 5242880 bits or 5242880 >> 3
-//        // This leaves (5242880 bytes - 5242880 bites) bytes left
-//
-//        // To convert from bytes to bits
-//        size_t bit_map_size = (size_t) (size >> 3);
-//        instance->d->bitmap = (char *) calloc(1, bit_map_size);
-//
-//        // To convert from bytes to blocks >> 9
-//        size_t block_size = (size_t) (size - bit_map_size) >> 9;
-//        instance->d->blocks = (cs1550_disk_block *) calloc(1, block_size);
+/**
+ * Cuts file down to size bytes and hands the blocks past the new end back to the bitmap, along with any extent block
+ * left empty. Each extent is visited once. The rest of the new last block is zeroed, so a later grow_file() never
+ * brings old data back.
+ *
+ * @param disk a pointer to the disk
+ * @param entry the directory block holding file
+ * @param file the file to shrink
+ * @param size the new file size, no bigger than the current one
+ */
+void shrink_file(cs1550_disk *disk, cs1550_directory_entry *entry, struct cs1550_file_directory *file, size_t size);
 
-    } else {
-        print_debug(("Accessed non-null instance\n"));
+/**
+ * Copies between buf and the file's blocks, following its extents. The range must already be allocated.
+ *
+ * Extents are only ever added at the end of a file, so an extent found once stays where it is until the file shrinks.
+ *
+ * @param write non-zero to copy buf into the file, zero to copy the file into buf
+ * @param cursor where to start looking if it isn't past offset, moved to the last extent copied; NULL to walk from
+ *      the first extent
+ */
+void file_io(cs1550_disk *disk, const struct cs1550_file_directory *file, char *buf, size_t size, off_t offset,
+             int write, struct extent_cursor *cursor);
 
-        if (dirty == true) {
-            print_debug(("!! ** Disk is dirty ** !!\nWriting out before read.\n"));
-            write_to_disk(instance->d);
-            dirty = false;
-        }
+/**
+ * Commits every change made so far. Data blocks are written home, and waited for, first. The metadata blocks then go
+ * into the journal as one transaction, and only reach their home once that is on the disk, so a crash leaves either
+ * all of them or none. Without a journal everything is written home directly. Operations carry on while the commit
+ * waits for the device; only taking the dirty maps over and copying the metadata shuts them out.
+ *
+ * @param disk a pointer to the disk
+ * @return EXIT_SUCCESS
+ *      -EIO if a dirty block can't be written back to ".disk"
+ *      -ENOMEM if there was no room to copy the metadata; it stays dirty for the next commit
+ */
+int write_to_disk(cs1550_disk *disk);
 
-        print_debug(("Opening disk for read\n"));
-        FILE *filePtr = fopen(".disk", "rb");
-        if (filePtr == NULL) {
-            exit(-EBADF);
-        }
+/**
+ * What fsync and fsyncdir do: commits every change made so far and waits for ".disk" to have it. With sync=none this
+ * does nothing.
+ *
+ * @param disk a pointer to the disk
+ * @return EXIT_SUCCESS
+ *      -EIO if the commit or the wait failed
+ */
+int sync_disk(cs1550_disk *disk);
 
-        fread(instance->d, sizeof(struct cs1550_disk), 1, filePtr);
-        print_debug(("Closed disk for read in get_instance\n"));
-        fclose(filePtr);
-    }
+/**
+ * Called by every operation that changed the disk, once it is done with the mapping. Operations are committed in
+ * groups: this one commits right away if enough have piled up since the last commit, else the commit thread gets to
+ * it within the commit interval. Without a journal, or with sync=strict, every operation is committed at once.
+ *
+ * @param disk a pointer to the disk
+ * @return EXIT_SUCCESS, or what write_to_disk() returned if it ran
+ */
+int finish_operation(cs1550_disk *disk);
 
-    return instance;
-}
+/**
+ * Remembers that the bytes [address, address + length) of the mapping were changed, so that the blocks holding them
+ * get written back by the next write_to_disk(). For the superblock, bitmap, directories and extent blocks, which go
+ * through the journal.
+ *
+ * @param disk a pointer to the disk
+ * @param address somewhere inside the mapping
+ * @param length number of bytes changed
+ */
+void mark_dirty(cs1550_disk *disk, const void *address, size_t length);
 
+/**
+ * mark_dirty() for the contents of files, which are written home without going through the journal.
+ */
+void mark_data_dirty(cs1550_disk *disk, const void *address, size_t length);
 
-// that means we store a 0 when the block is empty and 1 when the block is using information
-void set_bit_map(long offset, long length, char value, char *bitmap) {
-    long i;
-//    print_debug(("offset: %ld\tlength: %ld\tvalue: %d\n", offset, length, value));
+/**
+ * Starts the journal's ring over. Every transaction in it was written home by the commit that logged it, so once
+ * those writes are on the disk the header can move past them.
+ *
+ * @param disk a pointer to the disk
+ * @return EXIT_SUCCESS
+ *      -EIO if the header can't be written
+ */
+int checkpoint_journal(cs1550_disk *disk);
 
-    for (i = offset; i < offset + length; ++i) {
+/**
+ * Commits whatever the operations since the last commit left behind, every commit interval, until close_instance()
+ * stops it, and with sync=batched waits for what was written home without a journal. Started by open_instance() when
+ * the image has a journal, or with sync=batched.
+ *
+ * @param arg the disk
+ */
+void *commit_thread(void *arg);
 
-        if ((bitmap[i / 8] & (value << (i % 8))) == 1) {
-            print_debug(("Index %ld has value %8.8x\n", i / 8, bitmap[i / 8]));
-            print_debug(("Overwrote index %ld with %8.8x\n", i / 8, value << (i % 8)));
-        }
+/**
+ * Brings the windows that read_handle() queued into the page cache, one after the other, until close_instance()
+ * stops it. Started by open_instance() unless readahead is off.
+ *
+ * @param arg the disk
+ */
+void *readahead_thread(void *arg);
 
-//        if (0x3f & 0x40){
-//            print_debug(("i've got issues with math\n"));
-//        } else {
-//            print_debug(("i understand things\n"));
-//        }
+/**
+ * Copies every complete transaction left in the journal to its home. Runs before the image is mapped, on its own
+ * buffered descriptor, so it works the same whether or not the image is then opened with O_DIRECT.
+ *
+ * @param disk_path path of the image
+ * @return how many transactions were replayed
+ *      -EIO if the image couldn't be read or written
+ */
+int replay_journal(const char *disk_path);
 
-        bitmap[i / 8] |= value << (i % 8);
-    }
-}
+/**
+ * The one long-lived handle on ".disk". It is opened by the FUSE init hook and closed by destroy, and every read or
+ * write of the image goes through it rather than through per-request open()/close() pairs.
+ */
+struct cs1550_io {
+    int fd;
+    int direct;    // fd was opened with O_DIRECT, so buffers and offsets must be block aligned
+#ifdef CS1550_FAULTS
+    int fail_writes;    // writes still to refuse, from CS1550_FAIL_WRITES, so tests can make a commit fail
+#endif
+};
 
+/**
+ *
+ * @param io the context to fill in
+ * @param disk_path path of the image
+ * @param direct non-zero to try O_DIRECT first; falls back to buffered I/O if the file system refuses it
+ * @return EXIT_SUCCESS
+ *      -EBADF if the image can't be opened
+ */
+int io_open(struct cs1550_io *io, const char *disk_path, int direct);
 
-void print_bit_map(int offset, int length, char *bitmap) {
+void io_close(struct cs1550_io *io);
 
-    int j;
-    for (j = offset; j < length / 8; ++j) {
-        print_debug(("Index %d with %x\n", j, bitmap[j]));
-    }
-}
+/**
+ * Vectored write that keeps going after short writes until every iovec has been written.
+ *
+ * @return EXIT_SUCCESS
+ *      -EIO if the image refuses the write
+ */
+int io_pwritev(struct cs1550_io *io, const struct iovec *iov, int iovcnt, off_t offset);
 
+/**
+ * Vectored read that keeps going after short reads until every iovec has been filled.
+ *
+ * @return EXIT_SUCCESS
+ *      -EIO if the image can't be read, including reading past its end
+ */
+int io_preadv(struct cs1550_io *io, const struct iovec *iov, int iovcnt, off_t offset);
 
-int write_to_disk(cs1550_disk *disk) {
+int io_pwrite(struct cs1550_io *io, const void *buf, size_t length, off_t offset);
 
-    print_debug(("Opening disk for write\n"));
-    FILE *filePtr = fopen(".disk", "rb+");
-    if (filePtr == NULL) {
-        return -EBADF;
-    }
+/**
+ *
+ * @return EXIT_SUCCESS
+ *      -EIO if the data can't be made durable
+ */
+int io_sync(struct cs1550_io *io);
 
-    fwrite(disk, sizeof(struct cs1550_disk), 1, filePtr); //write struct to file
-    print_debug(("Closed disk after write\n"));
-    fclose(filePtr);
+// how many locks the directory blocks are spread over
+#define DIRECTORY_LOCKS 64
 
-    return EXIT_SUCCESS;
-}
+/*
+ * One name in a name_index, keyed by the block of its directory (0 for the root) and its whole name. Nodes are
+ * compared by hash, then length, and only then byte by byte.
+ */
+struct name_index_node {
+    struct name_index_node *next;    //next node in the same bucket
+    uint32_t hash;                   //NAME_HASH of the name, mixed with dir_block
+    long dir_block;
+    long value;                      //first block for a directory, slot in its directory for an entry
+    int length;
+    char name[];                     //not nul-terminated
+};
 
-// could cache results and return things if I update this when I write out information
-long get_free_block(char *bitmap) {
+// chained hash table mirroring the names on disk, so lookups don't scan directory blocks
+struct name_index {
+    struct name_index_node **buckets;
+    long bucket_count;    //always a power of two
+    long count;
+    pthread_rwlock_t lock;    //taken by the index functions themselves
+};
 
-    print_debug(("Getting free block starting index at: %ld\n", sizeof(struct cs1550_root_directory) - 1));
-    int i = sizeof(struct cs1550_root_directory) - 1;
+/**
+ *
+ * @param index the table to search
+ * @param dir_block block of the directory holding the name, 0 for the root
+ * @param name whole name of the directory or file
+ * @return the value stored with the name, -1 if it isn't there
+ */
+long index_lookup(struct name_index *index, long dir_block, const struct path_view *name);
 
-    // seek until I find the first free bit
-    // reserve the first block for root
-    for (; i < BIT_MAP_SIZE; ++i) {
+/**
+ * Adds a name, growing the table when it gets more than one name per bucket on average.
+ *
+ * @param name_hash NAME_HASH of name, which the image keeps for most names so the index needn't hash them again
+ */
+void index_insert(struct name_index *index, long dir_block, const struct path_view *name, uint32_t name_hash,
+                  long value);
 
-        if ((bitmap[i / 8] & (1 << (i % 8))) == 0) {
-            print_debug(("Free block at: %d\n", i));
-            break;
-        }
-    }
+/**
+ * Removes a name if it is there.
+ */
+void index_remove(struct name_index *index, long dir_block, const struct path_view *name);
 
-    return i;
-}
+void index_free(struct name_index *index);
 
+/*
+ * Where a directory or file with an inode number is: for a file the first block of its directory and its slot, for
+ * a directory its own first block and -1. A file's slot changes when an entry before it is removed, but its number
+ * and its directory don't.
+ */
+struct inode_node {
+    struct inode_node *next_number;    //next node in the same bucket by number
+    struct inode_node *next_place;     //next node in the same bucket by place
+    ino_t ino;
+    long dir_block;
+    long slot;
+    long parent;                       //first block of the directory it's in, 0 for the root
+};
 
-int get_path_info_for_mknod(const char *path, char **dir_name, char **full_file_name, char **file_name,
-                            char **extension_name) {
+/*
+ * Both ways between inode numbers and places, so neither a file's number nor a lookup by number depends on where
+ * its entry happens to be. A number is never handed out twice while the image is mounted, so one that has been
+ * removed can't come back naming something else. The numbers are kept on the image too, and count on from the
+ * highest one there at the next mount.
+ */
+struct inode_table {
+    struct inode_node **by_number;
+    struct inode_node **by_place;
+    long bucket_count;    //always a power of two, the same for both
+    long count;
+    ino_t next;           //number the next new directory or file gets
+    pthread_rwlock_t lock;    //taken by the inode functions themselves
+};
 
-    int result = 0;
+/**
+ * Adds a directory or file, growing the table when it gets more than one per bucket on average.
+ *
+ * @param ino its number, from inode_next() or the image; inode_next() hands out higher ones from then on
+ * @param dir_block first block of its directory, or of the directory itself
+ * @param slot slot of the file, -1 for a directory
+ * @param parent first block of the directory it's in, 0 for the root; dir_block for a file
+ */
+void inode_insert(struct inode_table *table, ino_t ino, long dir_block, long slot, long parent);
 
-    print_debug(("In get_path_info_for_mknod\n"));
+/**
+ * Hands out a number no directory or file has had yet.
+ */
+ino_t inode_next(struct inode_table *table);
 
-    get_path_info(path, dir_name, full_file_name, file_name, extension_name);
+/**
+ *
+ * @return the number of the directory or file, ROOT_INODE for the root, 0 if it isn't there
+ */
+ino_t inode_number(struct inode_table *table, long dir_block, long slot);
 
-    print_debug(("dir_name: %s\n", *dir_name));
-    print_debug(("full_file_name: %s\n", *full_file_name));
-    print_debug(("file_name: %s\n", *file_name));
-    print_debug(("extension_name: %s\n", *extension_name));
+/**
+ *
+ * @param dir_block set to the first block of the directory or of the file's directory, 0 for the root
+ * @param slot set to the slot of the file, -1 for a directory
+ * @return 0 on success
+ *      -ENOENT if nothing has that number (any more)
+ */
+int inode_place(struct inode_table *table, ino_t ino, long *dir_block, long *slot);
 
-    int file_letter_count = (int) strlen(*file_name);
-    int extension_letter_count = (int) strlen(*extension_name);
-    int dir_letter_count = (int) strlen(*dir_name);
+/**
+ *
+ * @return the number of the directory the directory or file is in, ROOT_INODE for the root and what is in it, 0 if
+ *      nothing has that number (any more)
+ */
+ino_t inode_parent(struct inode_table *table, ino_t ino);
 
-    if (file_letter_count > 8 || extension_letter_count > 3) {
-        result = -ENAMETOOLONG;
-    } else if (dir_letter_count > 8) {
-        result = -ENAMETOOLONG;
-    }
+/**
+ * Moves a file's number along with its entry.
+ */
+void inode_move(struct inode_table *table, long from, long to);
 
-    int i, slash_count = 0;
-    for (i = 0; i < strlen(path); ++i) {
-        if (path[i] == '/') {
-            slash_count++;
-        }
-    }
-    // we have tried to create a file in a subdirectory of a subdirectory
-    if (slash_count > 2) {
-        result = -EPERM;
-    }
+/**
+ * Takes a directory or file out; its number is never seen again.
+ */
+void inode_remove(struct inode_table *table, long dir_block, long slot);
 
-    print_debug(("Done get_path_info_for_mknod\n"));
+void inode_free(struct inode_table *table);
 
-//    free(dir_name);
-//    free(file_name);
-//    free(full_file_name);
-//    free(extension_name);
+// a directory path the path based front end has resolved before, as libfuse spells it, e.g. "/a/b"
+struct dentry {
+    struct dentry *next;    //next dentry in the same bucket
+    uint32_t hash;
+    long dir_block;
+    int length;
+    char path[];            //not nul-terminated
+};
 
-    return result;
-}
+/*
+ * Directory paths already walked, so a path costs one lookup however deep it goes. Only directories are kept: their
+ * blocks never move, while a file's slot does. There is no rename, so an entry only goes stale when its directory is
+ * removed, and a directory is only removed once it's empty, so nothing below it is cached any more either.
+ */
+struct dentry_cache {
+    struct dentry **buckets;
+    long bucket_count;    //always a power of two
+    long count;
+    pthread_rwlock_t lock;    //taken by the dentry functions themselves
+};
 
+/**
+ *
+ * @param cache the cache to search
+ * @param path a directory path
+ * @return the first block of the directory, -1 if the path isn't cached
+ */
+long dentry_lookup(struct dentry_cache *cache, const struct path_view *path);
 
-void get_path_info(const char *path, char **dir_name, char **full_file_name, char **file_name,
-                   char **extension_name) {
-    print_debug(("In get_path_info\n"));
+/**
+ * Caches a directory path, unless it already is.
+ */
+void dentry_insert(struct dentry_cache *cache, const struct path_view *path, long dir_block);
 
-    (*dir_name) = (char *) malloc(FILENAME_MAX);
-    (*file_name) = (char *) malloc(FILENAME_MAX);
-    (*extension_name) = (char *) malloc(FILENAME_MAX);
-    (*full_file_name) = (char *) malloc(FILENAME_MAX);
+/**
+ * Forgets a directory path if it is cached.
+ */
+void dentry_remove(struct dentry_cache *cache, const struct path_view *path);
 
-    int path_index = 0;
-    int dot_index = 0;
-    int num_slash = 0;
-    int in_dir = false;
-    int in_file = false;
+void dentry_free(struct dentry_cache *cache);
 
-    int i;
-    for (i = 0; i < strlen(path); i++) {
-        if (path[i] == '/') {
-            in_dir = true;
-            in_file = false;
-
-            num_slash++;
-            path_index = i;
-
-            if (num_slash == 2) {
-                // got directory
-                substring(path, dir_name, 1, i - 1);
-                print_debug(("dirname : %s\n", *dir_name));
-            } else if (num_slash > 2) {
-                // error with file name
-            }
-        } else if (path[i] == '.') {
-            dot_index = i;
-            in_dir = false;
-            in_file = true;
-            if (num_slash == 1) {
-                // error with file name
-            }
+// a commit is started by the operation that makes this many since the last one...
+#define COMMIT_OPERATIONS 64
+// ...or leaves this much waiting for write-back...
+#define COMMIT_DIRTY_BYTES (8 * 1024 * 1024)
+// ...and otherwise by the commit thread, this long after the last, unless the commit= mount option says otherwise
+#define COMMIT_INTERVAL_MS 1000
 
-        }
+/*
+ * How much a reply promises, chosen with the sync= mount option:
+ *
+ *      SYNC_STRICT     every operation is committed and on the disk before it is answered; writes aren't buffered
+ *      SYNC_BATCHED    operations are committed in groups as above, and each commit is on the disk once it is done;
+ *                      fsync and fsyncdir commit and wait
+ *      SYNC_NONE       only COMMIT_OPERATIONS and COMMIT_DIRTY_BYTES start a commit; fsync and fsyncdir do nothing
+ *
+ * A commit keeps the journal's ordering in every mode, so a crash loses recent operations but never leaves half of one.
+ */
+#define SYNC_NONE 0
+#define SYNC_BATCHED 1
+#define SYNC_STRICT 2
+
+/*
+ * Readahead: a handle whose reads keep picking up where the last one ended is a stream. Once one is seen, the
+ * readahead thread is asked to bring the extents ahead of it into the page cache, so they come off ".disk" while the
+ * kernel is still copying out what was read before. The window starts at READAHEAD_MIN and doubles every time the
+ * stream gets within half a window of what has been read ahead, up to the readahead= mount option. A read anywhere
+ * else starts the stream over.
+ */
+#define READAHEAD_MIN (128 * 1024)
+// largest window unless the readahead= mount option says otherwise
+#define DEFAULT_READAHEAD_KB 2048
+// windows waiting for the readahead thread; more are dropped, it being only a hint
+#define READAHEAD_QUEUE 32
+// extents brought in per window at most
+#define READAHEAD_EXTENTS 16
+
+struct readahead_request {
+    long dir_block;
+    long slot;
+    unsigned long generation;   //of the directory when the read asking for this was done
+    off_t offset;
+    size_t length;
+};
+
+/*
+ * Delayed allocation: a write past the end of a file goes into the file's write buffer instead of the mapping, and
+ * gets no blocks yet. The buffer holds the bytes from the file's size on. When it is flushed, on flush, release or
+ * truncate, when it is full, or when a write doesn't continue it, the file grows by all of it at once, so
+ * add_extent() can find one run of blocks for the lot. Until then the blocks it will need are taken off free_blocks,
+ * so a flush doesn't run out of room because of writes it was told about earlier.
+ */
+#define WRITE_BUFFER_MIN (64 * 1024)
+// biggest write buffer of a file unless the writebuffer= mount option says otherwise
+#define DEFAULT_WRITE_BUFFER_KB 8192
+
+struct write_buffer {
+    struct write_buffer *next;  //next buffer in the same stripe
+    long slot;                  //of the file; moves with the file's entry
+    long blocks;                //the file had when the buffer was started
+    long reserved;              //blocks taken off free_blocks for it
+    size_t length;              //bytes from the file's size on
+    size_t capacity;
+    char *data;
+};
+
+// how many lists the write buffers are hashed over
+#define BUFFER_STRIPES 64
+
+struct buffer_stripe {
+    pthread_mutex_t lock;
+    struct write_buffer *buffers;
+};
+
+// the journal of a mounted image
+struct cs1550_journal {
+    long start;                 // header block, 0 if the image has no journal
+    long blocks;                // blocks in the ring, the header not included
+    long head;                  // next free block of the ring
+    uint64_t sequence;          // sequence number of the next transaction
+    unsigned char *logged;      // one bit per image block with a copy somewhere in the ring
+    char *scratch;              // descriptor and commit blocks of the transaction being written, block aligned
+};
+
+struct Singleton {
+    cs1550_disk *d; // points straight into the private mapping of ".disk"
+    struct cs1550_io io;
+    unsigned char *dirty_blocks; // one bit per image block waiting for write-back
+    unsigned char *meta_blocks; // the dirty blocks that go through the journal
+    long dirty_count;
+    long meta_count;
+    unsigned char *commit_blocks; // the dirty map the commit under way took over, clear otherwise
+    unsigned char *commit_meta;
+    long *homes; // the metadata blocks of the commit under way, in order
+    char *snapshot; // and their copies, block aligned
+    long snapshot_size; // blocks there is room for
+    long pending; // operations finished since the last commit
+    struct cs1550_journal journal;
+    struct name_index directories; // (parent directory block, name) -> directory block
+    struct name_index files; // (directory block, name) -> slot of the file or subdirectory
+    struct inode_table inodes; // inode number <-> (directory block, slot) of every directory and file
+    struct dentry_cache dentries; // filled by the path based front end only
+    long free_hint; // every bit below this is known to be set, so searches never have to look further back
+    long free_blocks; // clear bits of the bitmap not set aside; counted at mount, then kept up by set_bit_map()
+
+    /*
+     * Locks, always taken in this order:
+     *
+     *      namespace_lock      the directory tree; shared to look a directory up, exclusive to add or remove one
+     *      directory_locks     a directory block and the files in it; shared to read a file or write inside it,
+     *                          exclusive to add a file or grow one
+     *      commit_lock         one commit at a time, its maps, copies and the journal
+     *      map_lock            shared around every change to the mapping; a commit holds it exclusively to take
+     *                          the dirty maps over, so it sees every operation either whole or not at all
+     *      alloc_lock          the bitmap, free_hint, free_blocks and the directory pool
+     *      dirty_lock          the dirty maps, their counts and the commit thread's wake-ups
+     *
+     * The name indexes lock themselves.
+     */
+    pthread_rwlock_t namespace_lock;
+    pthread_rwlock_t directory_locks[DIRECTORY_LOCKS]; // striped by directory block
+    unsigned long generations[DIRECTORY_LOCKS]; // striped the same way; see struct open_file
+    pthread_mutex_t commit_lock;
+    pthread_rwlock_t map_lock;
+    pthread_mutex_t alloc_lock;
+    pthread_mutex_t dirty_lock;
+
+    pthread_t committer; // runs commit_thread() if committing is set
+    pthread_cond_t commit_wake;
+    int committing;
+    int stopping;
+    int sync; // SYNC_NONE, SYNC_BATCHED or SYNC_STRICT
+    long commit_interval; // milliseconds
+    int unsynced; // written home without a journal since ".disk" was last waited for
+
+    size_t readahead_max; // largest window, 0 if readahead is off
+    pthread_t reader; // runs readahead_thread() unless readahead is off
+    pthread_mutex_t readahead_lock; // the queue and its counts; taken with nothing else held
+    pthread_cond_t readahead_wake;
+    struct readahead_request readahead_queue[READAHEAD_QUEUE];
+    int readahead_head;
+    int readahead_count;
+    int readahead_stopping;
+    unsigned long readahead_windows; // windows brought in
+    unsigned long readahead_bytes;
+    unsigned long readahead_dropped; // windows dropped because the queue was full
+
+    /*
+     * Write buffers, one per file that has any, hashed by slot over the stripes. Only the lists are under the stripe
+     * locks, which are taken with nothing else needed after them; a buffer itself is under its directory's lock,
+     * shared to read it, exclusive to change it.
+     */
+    size_t write_buffer_max; // biggest buffer, 0 if writes aren't buffered
+    long buffer_count; // changed atomically, so files can be looked at without a stripe lock while there are none
+    struct buffer_stripe buffer_stripes[BUFFER_STRIPES];
+};
+
+typedef struct Singleton *singleton;
+
+static singleton instance = NULL;
+
+struct Singleton *get_instance(void);
+
+/**
+ * Opens the image and maps it. Called once from the FUSE init hook.
+ *
+ * The mapping is private: stores stay in memory until write_to_disk() writes back exactly the blocks that
+ * mark_dirty() recorded, so nothing reaches ".disk" at page granularity or behind our back.
+ *
+ * An image without a superblock (e.g. fresh from dd) is formatted in place first.
+ *
+ * @param disk_path path of the image
+ * @param direct non-zero to write back with O_DIRECT
+ * @param block_size block size to format a blank image with
+ * @param readahead largest readahead window in bytes, 0 to go without readahead
+ * @param write_buffer biggest write buffer of a file in bytes, 0 to write straight into the mapping
+ * @param sync SYNC_NONE, SYNC_BATCHED or SYNC_STRICT
+ * @param commit_interval milliseconds between the commit thread's commits
+ */
+void open_instance(const char *disk_path, int direct, size_t block_size, size_t readahead,
+                   size_t write_buffer, int sync, long commit_interval);
+
+/**
+ * Writes back anything still dirty, unmaps the image and closes it. Called once from the FUSE destroy hook.
+ */
+void close_instance(void);
+
+/**
+ * Locks the directory tree and the directory index.
+ *
+ * @param exclusive true to add or remove a directory, false to look something up
+ */
+void lock_namespace(int exclusive);
+
+void unlock_namespace(void);
+
+/**
+ * Locks one directory block, its files and their extents.
+ *
+ * @param dir_block block of the directory; the root (0) shares a stripe with other directories, which is harmless
+ * @param exclusive true to change the directory's slots or a file's size and extents, false to read them
+ */
+void lock_directory(long dir_block, int exclusive);
+
+void unlock_directory(long dir_block);
+
+/**
+ * Fills the name indexes and the inode table from the root and every directory block. Called once the image is
+ * mapped.
+ */
+void build_index(cs1550_disk *disk);
+
+/**
+ * Only needs the namespace lock, since directories are only added and removed under it exclusively.
+ *
+ * @param disk pointer to the disk
+ * @param parent block of the directory to look in, 0 for the root
+ * @param dir_name the whole name of the directory, extension included
+ * @return the block of the directory, -1 if there is no such directory
+ */
+long find_directory(cs1550_disk *disk, long parent, const struct path_view *dir_name);
+
+/**
+ * Finds the directory a path names, in one lookup if the path has been resolved before and otherwise one per name,
+ * caching every directory on the way. The namespace lock must be held.
+ *
+ * @param disk pointer to the disk
+ * @param path a directory path such as "/a/b", empty for the root
+ * @return the block of the directory, 0 for the root, -1 if there is no such directory
+ */
+long resolve_directory(cs1550_disk *disk, const struct path_view *path);
+
+/**
+ *
+ * @param disk pointer to the disk
+ * @param dir_block block of the directory to look in
+ * @param name whole name of the file or subdirectory
+ * @return the slot of the file or subdirectory in the directory, -1 if there is no such name
+ */
+long find_entry(cs1550_disk *disk, long dir_block, const struct path_view *name);
+
+/**
+ * Like find_entry(), but for files only. The directory's lock must be held.
+ *
+ * @return the slot of the file in the directory, -1 if there is no such file
+ */
+long find_file(cs1550_disk *disk, long dir_block, const struct path_view *name);
+
+/**
+ * Checks that a name fits in a name block entry: up to MAX_NAME bytes.
+ *
+ * @param name whole name of a file or directory
+ * @return 0 if it fits
+ *      -ENAMETOOLONG if it doesn't
+ */
+int check_name(const struct path_view *name);
+
+/**
+ * Copies the whole name of an entry of a directory other than the root, wherever the image keeps it.
+ *
+ * @param disk pointer to the disk
+ * @param file the entry
+ * @param buf at least MAX_NAME + 1 bytes, filled in with the nul-terminated name
+ * @return the length of the name
+ */
+int entry_name(cs1550_disk *disk, const struct cs1550_file_directory *file, char *buf);
+
+/**
+ * entry_name() for a directory in the root.
+ */
+int root_name(cs1550_disk *disk, const struct cs1550_directory *directory, char *buf);
+
+/*
+ * The operations below work on a directory block and a slot that were already looked up, so the path based and the
+ * inode based front ends share them. The caller holds the namespace lock and the directory's lock, and keeps them
+ * for as long as it uses what it looked up.
+ */
+
+/**
+ *
+ * @param disk pointer to the disk
+ * @param dir_block block of the directory, or of the directory holding the file; 0 for the root
+ * @param slot slot of the file in its directory, -1 for the directory itself
+ * @param stbuf filled in with the attributes
+ */
+void stat_entry(cs1550_disk *disk, long dir_block, long slot, struct stat *stbuf);
+
+/**
+ * Reports the free blocks and slots from the counters kept up to date as they are taken and given back, without
+ * looking at the bitmap or any directory. Needs no locks held.
+ *
+ * @param disk pointer to the disk
+ * @param stbuf filled in with the totals
+ */
+void stat_disk(cs1550_disk *disk, struct statvfs *stbuf);
+
+/**
+ * Adds a directory to the root or to another directory. The namespace lock must be held exclusively.
+ *
+ * @param disk pointer to the disk
+ * @param parent block of the directory to add it to, 0 for the root
+ * @param dir_name whole name of the new directory
+ * @param dir_block set to the block of the new directory
+ * @return 0 on success
+ *      -ENAMETOOLONG if check_name() refuses the name
+ *      -EEXIST if the name is already taken
+ *      -ENOSPC if there is no block left for it or its name
+ */
+int create_directory(cs1550_disk *disk, long parent, const struct path_view *dir_name, long *dir_block);
+
+/**
+ * Adds an empty file to a directory. The directory's lock must be held exclusively.
+ *
+ * @param disk pointer to the disk
+ * @param dir_block block of the directory
+ * @param name whole name of the new file
+ * @param slot set to the slot of the new file
+ * @return 0 on success
+ *      -ENAMETOOLONG if check_name() refuses the name
+ *      -EEXIST if the file already exists
+ *      -ENOSPC if there is no block left for its entry or its name
+ */
+int create_file(cs1550_disk *disk, long dir_block, const struct path_view *name, long *slot);
+
+/**
+ * @param cursor see file_io(), may be NULL
+ * @return how many bytes were read, less than size (down to 0) if the file ends first
+ */
+int read_file(cs1550_disk *disk, long slot, char *buf, size_t size, off_t offset, struct extent_cursor *cursor);
+
+/**
+ *
+ * @return true if writing size bytes at offset makes the file bigger, in which case the directory's lock has to be
+ *      held exclusively for the write
+ */
+int write_grows_file(cs1550_disk *disk, long slot, size_t size, off_t offset);
+
+/**
+ * Leaves the file's times alone; write_handle() stamps them with the directory's lock held exclusively.
+ *
+ * @param cursor see file_io(), may be NULL
+ * @return size on success
+ *      -ENOSPC if the file has to grow and the disk is full
+ */
+int write_file(cs1550_disk *disk, long slot, const char *buf, size_t size, off_t offset,
+               struct extent_cursor *cursor);
+
+/**
+ * Gives a file the blocks for what its write buffer holds and copies it there. The directory's lock must be held
+ * exclusively.
+ *
+ * @param disk pointer to the disk
+ * @param slot slot of the file
+ * @return 0 on success, also if the file has no write buffer
+ *      -ENOSPC if the disk filled up anyway; the buffer is kept for the next flush to try again
+ *      -EIO if the commit that followed failed
+ */
+int flush_buffer(cs1550_disk *disk, long slot);
+
+/**
+ * Throws the write buffer of the file in slot away, for a file that is removed or cut down to where the buffer
+ * starts. The directory's lock must be held exclusively.
+ */
+void drop_buffer(long slot);
+
+/**
+ * Sets the size of a file, freeing the blocks past a smaller size or adding zeroed ones for a bigger one. The
+ * directory's lock must be held exclusively.
+ *
+ * @return 0 on success
+ *      -ENOSPC if the file has to grow and the disk is full
+ */
+int truncate_file(cs1550_disk *disk, long dir_block, long slot, off_t size);
+
+/**
+ * Sets when the contents of a directory or file last changed, as utimes() does; its ctime becomes now. The
+ * directory's lock must be held exclusively.
+ *
+ * @param slot slot of the file, -1 for the directory dir_block itself (0 for the root)
+ */
+void set_mtime(cs1550_disk *disk, long dir_block, long slot, time_t mtime);
+
+/**
+ * Removes a file and frees its blocks. The last entry of the directory moves into the emptied slot, so the slots stay
+ * packed. The directory's lock must be held exclusively.
+ *
+ * @param disk pointer to the disk
+ * @param dir_block block of the directory
+ * @param slot slot of the file
+ */
+void remove_file(cs1550_disk *disk, long dir_block, long slot);
+
+/**
+ * Removes an empty directory and frees its block. The last entry of the directory holding it moves into the emptied
+ * slot. The namespace lock must be held exclusively.
+ *
+ * @param disk pointer to the disk
+ * @param parent block of the directory holding it, 0 for the root
+ * @param dir_name whole name of the directory
+ * @return 0 on success
+ *      -ENOENT if there is no such name
+ *      -ENOTDIR if the name is a file
+ *      -ENOTEMPTY if the directory still has files or subdirectories
+ */
+int remove_directory(cs1550_disk *disk, long parent, const struct path_view *dir_name);
+
+/*
+ * A file as open or create found it, handed to the kernel in fi->fh. Reads and writes go straight to its slot and
+ * pick up in its extents where the last one left off, instead of looking the name up and walking the extents again.
+ *
+ * A slot stays right for as long as its directory's generation doesn't change; removing a file, shrinking one and
+ * removing the directory move the generation on. A handle that sees a new generation finds its file again by inode
+ * number, which never names another file, even one created under the same name after it went.
+ */
+struct open_file {
+    pthread_mutex_t lock;               //the fields below, between requests sharing the handle
+    long dir_block;                     //never changes
+    ino_t ino;                          //never changes
+    long slot;
+    unsigned long generation;           //of the directory when slot was found
+    struct extent_cursor cursor;
+    off_t next_read;                    //where the last read ended
+    off_t ahead;                        //how far the stream has been read ahead
+    size_t window;                      //last readahead window, 0 while reads aren't sequential
+};
+
+/**
+ * The directory's lock must be held.
+ *
+ * @param dir_block block of the directory holding the file
+ * @param slot slot of the file
+ * @return a new handle for the file, NULL if there is no memory for it
+ */
+struct open_file *open_handle(long dir_block, long slot);
+
+/**
+ * Frees a handle from open_handle().
+ */
+void close_handle(struct open_file *handle);
+
+/**
+ * Reads through a handle, taking the namespace lock and the directory's lock itself.
+ *
+ * @return how many bytes were read, less than size (down to 0) if the file ends first
+ *      -ENOENT if the file has been removed
+ */
+int read_handle(cs1550_disk *disk, struct open_file *handle, char *buf, size_t size, off_t offset);
+
+/**
+ * Writes through a handle, taking the namespace lock and the directory's lock itself.
+ *
+ * @return size on success
+ *      -ENOENT if the file has been removed
+ *      -ENOSPC if the file has to grow and the disk is full
+ */
+int write_handle(cs1550_disk *disk, struct open_file *handle, const char *buf, size_t size, off_t offset);
+
+/**
+ * Flushes the write buffer of a handle's file, taking the namespace lock and the directory's lock itself.
+ *
+ * @return 0 on success, also if the file has been removed
+ *      otherwise what flush_buffer() returned
+ */
+int flush_handle(cs1550_disk *disk, struct open_file *handle);
+
+/**
+ *
+ * By using a singleton to wrap our disk access we can be sure that we are accessing the most up-to-date information.
+ *
+ * The instance is set up by open_instance() before the first request arrives, so this is only a pointer read.
+ *
+ * @return pointer to singleton
+ */
+struct Singleton *get_instance(void) {
+    assert(instance != NULL);
+    return instance;
+}
+
+
+int io_open(struct cs1550_io *io, const char *disk_path, int direct) {
+    io->fd = -1;
+    io->direct = false;
+#ifdef CS1550_FAULTS
+    io->fail_writes = getenv("CS1550_FAIL_WRITES") != NULL ? atoi(getenv("CS1550_FAIL_WRITES")) : 0;
+#endif
+
+#ifdef O_DIRECT
+    if (direct) {
+        io->fd = open(disk_path, O_RDWR | O_DIRECT);
+        if (io->fd != -1) {
+            io->direct = true;
+        } else {
+            print_debug(("O_DIRECT refused for %s, using buffered I/O\n", disk_path));
+        }
+    }
+#else
+    (void) direct;
+#endif
+
+    if (io->fd == -1) {
+        io->fd = open(disk_path, O_RDWR);
+    }
+
+    return io->fd == -1 ? -EBADF : EXIT_SUCCESS;
+}
+
+
+void io_close(struct cs1550_io *io) {
+    if (io->fd != -1) {
+        close(io->fd);
+        io->fd = -1;
+    }
+}
+
+
+int io_pwritev(struct cs1550_io *io, const struct iovec *iov, int iovcnt, off_t offset) {
+    struct iovec rest[IOV_MAX];
+    assert(iovcnt <= IOV_MAX);
+    memcpy(rest, iov, iovcnt * sizeof(struct iovec));
+
+#ifdef CS1550_FAULTS
+    if (__atomic_load_n(&io->fail_writes, __ATOMIC_RELAXED) > 0 &&
+        __atomic_fetch_sub(&io->fail_writes, 1, __ATOMIC_RELAXED) > 0) {
+        return -EIO;
+    }
+#endif
+
+    struct iovec *next = rest;
+    while (iovcnt > 0) {
+        ssize_t written = pwritev(io->fd, next, iovcnt, offset);
+        if (written <= 0) {
+            return -EIO;
+        }
+        offset += written;
+
+        // step over the iovecs that went out in full and trim the one that was cut short
+        while (iovcnt > 0 && (size_t) written >= next->iov_len) {
+            written -= next->iov_len;
+            ++next;
+            --iovcnt;
+        }
+        if (iovcnt > 0) {
+            next->iov_base = (char *) next->iov_base + written;
+            next->iov_len -= written;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+
+int io_preadv(struct cs1550_io *io, const struct iovec *iov, int iovcnt, off_t offset) {
+    struct iovec rest[IOV_MAX];
+    assert(iovcnt <= IOV_MAX);
+    memcpy(rest, iov, iovcnt * sizeof(struct iovec));
+
+    struct iovec *next = rest;
+    while (iovcnt > 0) {
+        ssize_t got = preadv(io->fd, next, iovcnt, offset);
+        if (got <= 0) {
+            return -EIO;
+        }
+        offset += got;
+
+        while (iovcnt > 0 && (size_t) got >= next->iov_len) {
+            got -= next->iov_len;
+            ++next;
+            --iovcnt;
+        }
+        if (iovcnt > 0) {
+            next->iov_base = (char *) next->iov_base + got;
+            next->iov_len -= got;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+
+int io_pwrite(struct cs1550_io *io, const void *buf, size_t length, off_t offset) {
+    struct iovec iov = {(void *) buf, length};
+    return io_pwritev(io, &iov, 1, offset);
+}
+
+
+int io_sync(struct cs1550_io *io) {
+    return fdatasync(io->fd) == -1 ? -EIO : EXIT_SUCCESS;
+}
+
+
+int format_disk(cs1550_disk *disk, size_t block_size) {
+    struct cs1550_superblock super;
+    int result = layout_disk((off_t) disk->size, block_size, 0, DEFAULT_JOURNAL_BLOCKS, &super);
+    if (result == -ENOSPC) {
+        // too small for a journal too; it still works without one
+        result = layout_disk((off_t) disk->size, block_size, 0, 0, &super);
+    }
+    if (result != EXIT_SUCCESS) {
+        return result;
+    }
+
+    disk->block_size = super.block_size;
+    disk->block_count = (long) super.block_count;
+    disk->super = (struct cs1550_superblock *) disk->image;
+    disk->bitmap = disk->image + super.bitmap_start * block_size;
+    disk->root_block = (long) super.root_block;
+
+    // superblock, bitmap, root and journal header are all that needs to be written; the rest of the image is never
+    // read before it's allocated
+    format_metadata(disk->image, &super, time(NULL));
+    mark_dirty(disk, disk->image, metadata_blocks(&super) * block_size);
+
+    return EXIT_SUCCESS;
+}
+
+
+void open_instance(const char *disk_path, int direct, size_t block_size, size_t readahead,
+                   size_t write_buffer, int sync, long commit_interval) {
+    assert(instance == NULL);
+    assert(dirty == false);
+
+    // get map for struct
+    instance = (singleton) calloc(1, sizeof(struct Singleton));
+    instance->d = (cs1550_disk *) calloc(1, sizeof(struct cs1550_disk));
+    cs1550_disk *disk = instance->d;
+
+    // FUSE calls init once, before it hands out any other request, so everything set up here is seen by every thread
+    // that serves one
+    int i;
+    for (i = 0; i < DIRECTORY_LOCKS; ++i) {
+        pthread_rwlock_init(&instance->directory_locks[i], NULL);
+    }
+    pthread_rwlock_init(&instance->namespace_lock, NULL);
+    pthread_mutex_init(&instance->alloc_lock, NULL);
+    pthread_mutex_init(&instance->commit_lock, NULL);
+    pthread_rwlock_init(&instance->map_lock, NULL);
+    pthread_mutex_init(&instance->dirty_lock, NULL);
+    pthread_cond_init(&instance->commit_wake, NULL);
+    pthread_mutex_init(&instance->readahead_lock, NULL);
+    pthread_cond_init(&instance->readahead_wake, NULL);
+    for (i = 0; i < BUFFER_STRIPES; ++i) {
+        pthread_mutex_init(&instance->buffer_stripes[i].lock, NULL);
+    }
+    pthread_rwlock_init(&instance->directories.lock, NULL);
+    pthread_rwlock_init(&instance->files.lock, NULL);
+    pthread_rwlock_init(&instance->inodes.lock, NULL);
+    instance->inodes.next = ROOT_INODE + 1;
+    pthread_rwlock_init(&instance->dentries.lock, NULL);
+
+    instance->sync = sync;
+    instance->commit_interval = commit_interval;
+
+    // whatever a crash left committed in the journal goes home before anything looks at the image
+    int replayed = replay_journal(disk_path);
+    if (replayed < 0) {
+        fprintf(stderr, "cs1550: can't replay the journal of %s\n", disk_path);
+        exit(-EIO);
+    }
+    print_debug(("Replayed %d journal transactions\n", replayed));
+
+    print_debug(("Opening disk %s\n", disk_path));
+    if (io_open(&instance->io, disk_path, direct) != EXIT_SUCCESS) {
+        exit(-EBADF);
+    }
+
+    struct stat st;
+    if (fstat(instance->io.fd, &st) == -1 || st.st_size < MIN_BLOCK_SIZE) {
+        fprintf(stderr, "cs1550: %s is too small to be a disk\n", disk_path);
+        exit(-EBADF);
+    }
+
+    void *map = mmap(NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, instance->io.fd, 0);
+    if (map == MAP_FAILED) {
+        exit(-EBADF);
+    }
+    disk->image = (char *) map;
+    disk->size = (size_t) st.st_size;
+    disk->super = (struct cs1550_superblock *) map;
+
+    struct cs1550_superblock *super = disk->super;
+    if (super->magic != CS1550_MAGIC) {
+        // a blank image straight from dd; size it from the file and format it with the default block size
+        print_debug(("No superblock, formatting with %ld byte blocks\n", (long) block_size));
+
+        instance->dirty_blocks = calloc(1, (size_t) ((st.st_size / MIN_BLOCK_SIZE + 7) / 8));
+        instance->meta_blocks = calloc(1, (size_t) ((st.st_size / MIN_BLOCK_SIZE + 7) / 8));
+        instance->commit_blocks = calloc(1, (size_t) ((st.st_size / MIN_BLOCK_SIZE + 7) / 8));
+        instance->commit_meta = calloc(1, (size_t) ((st.st_size / MIN_BLOCK_SIZE + 7) / 8));
+        if (format_disk(disk, block_size) != EXIT_SUCCESS) {
+            fprintf(stderr, "cs1550: can't format %s with %ld byte blocks\n", disk_path, (long) block_size);
+            exit(-EINVAL);
+        }
+        write_to_disk(disk);
+    } else {
+        struct cs1550_superblock expected;
+        if (super->version != CS1550_VERSION ||
+            layout_disk((off_t) (super->block_count * super->block_size), super->block_size, 0, 0, &expected) !=
+            EXIT_SUCCESS || expected.bitmap_blocks > super->bitmap_blocks ||
+            super->root_block < super->bitmap_start + super->bitmap_blocks ||
+            super->root_block >= super->block_count ||
+            super->dir_pool_next > super->dir_pool_end || super->dir_pool_end >= super->block_count ||
+            super->block_count * super->block_size > (uint64_t) st.st_size ||
+            (super->journal_blocks > 0 &&
+             (super->journal_blocks < 3 || super->journal_start != super->root_block + 1 ||
+              super->journal_start + super->journal_blocks > super->dir_pool_next))) {
+            fprintf(stderr, "cs1550: superblock of %s doesn't describe this image\n", disk_path);
+            exit(-EINVAL);
+        }
+
+        disk->block_size = super->block_size;
+        disk->block_count = (long) super->block_count;
+        disk->bitmap = disk->image + super->bitmap_start * super->block_size;
+        disk->root_block = (long) super->root_block;
+        instance->dirty_blocks = calloc(1, (size_t) ((disk->block_count + 7) / 8));
+        instance->meta_blocks = calloc(1, (size_t) ((disk->block_count + 7) / 8));
+        instance->commit_blocks = calloc(1, (size_t) ((disk->block_count + 7) / 8));
+        instance->commit_meta = calloc(1, (size_t) ((disk->block_count + 7) / 8));
+    }
+
+    if (super->journal_blocks > 0) {
+        struct cs1550_journal *journal = &instance->journal;
+        long per_descriptor = (long) HOMES_PER_DESCRIPTOR(disk->block_size);
+
+        journal->start = (long) super->journal_start;
+        journal->blocks = (long) super->journal_blocks - 1;
+        journal->head = 0;
+        journal->sequence = ((struct cs1550_journal_header *) block_address(disk, journal->start))->sequence;
+        journal->logged = calloc(1, (size_t) ((disk->block_count + 7) / 8));
+
+        // one block per descriptor and one for the commit; aligned for O_DIRECT
+        void *scratch;
+        if (posix_memalign(&scratch, (size_t) sysconf(_SC_PAGESIZE),
+                           (size_t) (journal->blocks / per_descriptor + 2) * disk->block_size) != 0) {
+            exit(-ENOMEM);
+        }
+        journal->scratch = (char *) scratch;
+    }
+
+    instance->committing = instance->journal.start != 0 || sync == SYNC_BATCHED;
+    if (instance->committing) {
+        pthread_create(&instance->committer, NULL, commit_thread, disk);
+    }
+    instance->readahead_max = readahead;
+    instance->write_buffer_max = write_buffer;
+    if (readahead > 0) {
+        pthread_create(&instance->reader, NULL, readahead_thread, disk);
+    }
+
+    build_index(disk);
+
+    // the only time the bitmap gets counted; from here on set_bit_map() keeps track
+    instance->free_blocks = disk->block_count - bitmap_count(disk->bitmap, 0, disk->block_count);
+
+    print_debug(("disk size: %ld\n", (long) st.st_size));
+    print_debug(("block size: %ld\n", (long) disk->block_size));
+    print_debug(("blocks: %ld\n", disk->block_count));
+    print_debug(("max directories = %ld\n", (long) MAX_DIRS_IN_ROOT(disk)));
+    print_debug(("max files in dir = %ld\n", (long) MAX_FILES_IN_DIR(disk)));
+    print_debug(("direct I/O: %d\n", instance->io.direct));
+    print_debug(("sync: %d, commit every %ld ms\n", instance->sync, instance->commit_interval));
+    print_debug(("journal: %ld blocks at %ld\n", instance->journal.blocks, instance->journal.start));
+    print_debug(("readahead: up to %ld bytes\n", (long) instance->readahead_max));
+    print_debug(("write buffers: up to %ld bytes\n", (long) instance->write_buffer_max));
+    print_debug(("blocks in use: %ld of %ld\n", disk->block_count - instance->free_blocks, disk->block_count));
+    print_debug(("indexed %ld directories and %ld files\n", instance->directories.count, instance->files.count));
+}
+
+
+void close_instance(void) {
+    if (instance == NULL) {
+        return;
+    }
+
+    // every handle has been released by the time destroy runs, so this only finds buffers if a release failed; a
+    // second failure here has nobody left to tell but the log
+    int i;
+    for (i = 0; i < BUFFER_STRIPES; ++i) {
+        while (instance->buffer_stripes[i].buffers != NULL) {
+            struct write_buffer *pending = instance->buffer_stripes[i].buffers;
+            size_t length = pending->length;
+            long slot = pending->slot;
+            int result = flush_buffer(instance->d, slot);
+            if (result != 0) {
+                fprintf(stderr, "cs1550: %ld buffered bytes of a file are lost: %s\n", (long) length,
+                        strerror(-result));
+                drop_buffer(slot);
+            }
+        }
+    }
+
+    // every request has finished by the time destroy runs, so only the commit and readahead threads are left
+    if (instance->readahead_max > 0) {
+        pthread_mutex_lock(&instance->readahead_lock);
+        instance->readahead_stopping = true;
+        pthread_cond_signal(&instance->readahead_wake);
+        pthread_mutex_unlock(&instance->readahead_lock);
+        pthread_join(instance->reader, NULL);
+        print_debug(("readahead: %lu windows, %lu bytes, %lu dropped\n", instance->readahead_windows,
+                instance->readahead_bytes, instance->readahead_dropped));
+    }
+    if (instance->committing) {
+        pthread_mutex_lock(&instance->dirty_lock);
+        instance->stopping = true;
+        pthread_cond_signal(&instance->commit_wake);
+        pthread_mutex_unlock(&instance->dirty_lock);
+        pthread_join(instance->committer, NULL);
+    }
+
+    if (dirty == true) {
+        print_debug(("!! ** Disk is dirty ** !!\nWriting out before unmount.\n"));
+        write_to_disk(instance->d);
+    }
+
+    // everything is home, so the next mount has nothing to replay
+    if (instance->journal.start != 0) {
+        checkpoint_journal(instance->d);
+    }
+    io_sync(&instance->io);
+
+    munmap(instance->d->image, instance->d->size);
+    io_close(&instance->io);
+    free(instance->dirty_blocks);
+    free(instance->meta_blocks);
+    free(instance->commit_blocks);
+    free(instance->commit_meta);
+    free(instance->homes);
+    free(instance->snapshot);
+    free(instance->journal.logged);
+    free(instance->journal.scratch);
+    index_free(&instance->directories);
+    index_free(&instance->files);
+    inode_free(&instance->inodes);
+    dentry_free(&instance->dentries);
+
+    for (i = 0; i < DIRECTORY_LOCKS; ++i) {
+        pthread_rwlock_destroy(&instance->directory_locks[i]);
+    }
+    pthread_rwlock_destroy(&instance->namespace_lock);
+    pthread_mutex_destroy(&instance->alloc_lock);
+    pthread_mutex_destroy(&instance->commit_lock);
+    pthread_rwlock_destroy(&instance->map_lock);
+    pthread_mutex_destroy(&instance->dirty_lock);
+    pthread_cond_destroy(&instance->commit_wake);
+    pthread_mutex_destroy(&instance->readahead_lock);
+    pthread_cond_destroy(&instance->readahead_wake);
+    for (i = 0; i < BUFFER_STRIPES; ++i) {
+        pthread_mutex_destroy(&instance->buffer_stripes[i].lock);
+    }
+    pthread_rwlock_destroy(&instance->directories.lock);
+    pthread_rwlock_destroy(&instance->files.lock);
+    pthread_rwlock_destroy(&instance->inodes.lock);
+    pthread_rwlock_destroy(&instance->dentries.lock);
+
+    free(instance->d);
+    free(instance);
+    instance = NULL;
+}
+
+
+void lock_namespace(int exclusive) {
+    if (exclusive) {
+        pthread_rwlock_wrlock(&get_instance()->namespace_lock);
+    } else {
+        pthread_rwlock_rdlock(&get_instance()->namespace_lock);
+    }
+}
+
+
+void unlock_namespace(void) {
+    pthread_rwlock_unlock(&get_instance()->namespace_lock);
+}
+
+
+void lock_directory(long dir_block, int exclusive) {
+    pthread_rwlock_t *lock = &get_instance()->directory_locks[dir_block % DIRECTORY_LOCKS];
+
+    if (exclusive) {
+        pthread_rwlock_wrlock(lock);
+    } else {
+        pthread_rwlock_rdlock(lock);
+    }
+}
+
+
+void unlock_directory(long dir_block) {
+    pthread_rwlock_unlock(&get_instance()->directory_locks[dir_block % DIRECTORY_LOCKS]);
+}
+
+
+/*
+ * Loads the 64 bits of bitmap word index as a number whose bit n is bit (index * 64 + n) of the bitmap.
+ */
+static inline uint64_t bitmap_word(const char *bitmap, long index) {
+    uint64_t word;
+    memcpy(&word, bitmap + index * sizeof(uint64_t), sizeof(uint64_t));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return word;
+}
+
+
+// that means we store a 0 when the block is empty and 1 when the block is using information
+void set_bit_map(long offset, long length, char value, char *bitmap) {
+//    print_debug(("offset: %ld\tlength: %ld\tvalue: %d\n", offset, length, value));
+
+    if (value) {
+        bitmap_set_range(bitmap, offset, offset + length);
+        get_instance()->free_blocks -= length;
+    } else {
+        bitmap_clear_range(bitmap, offset, offset + length);
+        get_instance()->free_blocks += length;
+        release_free_blocks(offset);
+    }
+}
+
+
+/*
+ * Shared body of bitmap_set_range() and bitmap_clear_range(): partial bytes at either end get masked, whole bytes
+ * up to the next word boundary get stored, and everything in between is stored 64 bits at a time.
+ */
+static void bitmap_fill(char *bitmap, long start, long end, int value) {
+    unsigned char fill = value ? 0xff : 0x00;
+
+    if (start >= end) {
+        return;
+    }
+
+    long first_byte = start / 8;
+    long last_byte = (end - 1) / 8;
+
+    if (first_byte == last_byte) {
+        unsigned char mask = (unsigned char) ((0xff << (start % 8)) & (0xff >> (7 - (end - 1) % 8)));
+        bitmap[first_byte] = (char) (value ? bitmap[first_byte] | mask : bitmap[first_byte] & ~mask);
+        return;
+    }
+
+    // head: the bits of the first byte from start on
+    unsigned char head = (unsigned char) (0xff << (start % 8));
+    bitmap[first_byte] = (char) (value ? bitmap[first_byte] | head : bitmap[first_byte] & ~head);
+
+    // tail: the bits of the last byte up to end
+    unsigned char tail = (unsigned char) (0xff >> (7 - (end - 1) % 8));
+    bitmap[last_byte] = (char) (value ? bitmap[last_byte] | tail : bitmap[last_byte] & ~tail);
+
+    long i = first_byte + 1;
+
+    while (i < last_byte && i % sizeof(uint64_t) != 0) {
+        bitmap[i++] = (char) fill;
+    }
+
+    uint64_t word = value ? ~0ULL : 0ULL;
+    while (i + (long) sizeof(uint64_t) <= last_byte) {
+        memcpy(bitmap + i, &word, sizeof(uint64_t));
+        i += sizeof(uint64_t);
+    }
+
+    while (i < last_byte) {
+        bitmap[i++] = (char) fill;
+    }
+}
+
+
+void bitmap_set_range(char *bitmap, long start, long end) {
+    bitmap_fill(bitmap, start, end, 1);
+}
+
+
+void bitmap_clear_range(char *bitmap, long start, long end) {
+    bitmap_fill(bitmap, start, end, 0);
+}
+
+
+long bitmap_count(const char *bitmap, long start, long end) {
+    long count = 0;
+
+    // count whole words and mask off whatever lies outside [start, end) in the first and last one
+    long index;
+    for (index = start / 64; index * 64 < end; ++index) {
+        uint64_t word = bitmap_word(bitmap, index);
+        if (index == start / 64) {
+            word &= ~0ULL << (start % 64);
+        }
+        if ((index + 1) * 64 > end) {
+            word &= ~0ULL >> (64 - end % 64);
+        }
+        count += __builtin_popcountll(word);
+    }
+
+    return count;
+}
+
+
+void print_bit_map(int offset, int length, char *bitmap) {
+
+    int j;
+    for (j = offset; j < length / 8; ++j) {
+        print_debug(("Index %d with %x\n", j, bitmap[j]));
+    }
+}
+
+
+/*
+ * Shared body of mark_dirty() and mark_data_dirty().
+ */
+static void mark_blocks(cs1550_disk *disk, const void *address, size_t length, int metadata) {
+    struct Singleton *instance = get_instance();
+
+    if (length == 0) {
+        return;
+    }
+
+    long offset = (const char *) address - disk->image;
+    assert(offset >= 0 && offset + length <= disk->block_count * disk->block_size);
+
+    pthread_mutex_lock(&instance->dirty_lock);
+
+    long i;
+    for (i = offset / (long) disk->block_size; i <= (long) ((offset + length - 1) / disk->block_size); ++i) {
+        unsigned char bit = (unsigned char) (1 << (i % 8));
+
+        if ((instance->dirty_blocks[i / 8] & bit) == 0) {
+            instance->dirty_blocks[i / 8] |= bit;
+            instance->dirty_count++;
+        }
+        // a block that is metadata anywhere in the transaction stays metadata
+        if (metadata && (instance->meta_blocks[i / 8] & bit) == 0) {
+            instance->meta_blocks[i / 8] |= bit;
+            instance->meta_count++;
+        }
+    }
+
+    dirty = true;
+
+    pthread_mutex_unlock(&instance->dirty_lock);
+}
+
+
+void mark_dirty(cs1550_disk *disk, const void *address, size_t length) {
+    mark_blocks(disk, address, length, true);
+}
+
+
+void mark_data_dirty(cs1550_disk *disk, const void *address, size_t length) {
+    mark_blocks(disk, address, length, false);
+}
+
+
+/*
+ * Writes the data blocks a commit took over to their home, coalescing runs into one pwrite each. They go straight from
+ * the mapping, which may have changed since: such a block is dirty again, and the next commit writes it once more.
+ *
+ * @return EXIT_SUCCESS
+ *      -EIO if a block couldn't be written
+ */
+static int write_back(cs1550_disk *disk) {
+    struct Singleton *instance = get_instance();
+    const unsigned char *blocks = instance->commit_blocks, *meta = instance->commit_meta;
+    int result = EXIT_SUCCESS;
+
+    long i = 0;
+    while (i < disk->block_count) {
+        // skip whole clean bytes of the map at once
+        if ((blocks[i / 8] & ~meta[i / 8]) == 0) {
+            i = (i / 8 + 1) * 8;
+            continue;
+        }
+        if (!(blocks[i / 8] & ~meta[i / 8] & (1 << (i % 8)))) {
+            ++i;
+            continue;
+        }
+
+        // coalesce the run of dirty blocks starting at i into one pwrite
+        long run_start = i;
+        while (i < disk->block_count && (blocks[i / 8] & ~meta[i / 8] & (1 << (i % 8)))) {
+            ++i;
+        }
+
+        off_t start = (off_t) run_start * disk->block_size;
+        size_t length = (size_t) (i - run_start) * disk->block_size;
+
+        if (io_pwrite(&instance->io, disk->image + start, length, start) != EXIT_SUCCESS) {
+            result = -EIO;
+        }
+    }
+
+    return result;
+}
+
+
+/*
+ * Writes the copies of a commit's metadata blocks to their home, a run of neighbouring blocks in one pwrite.
+ *
+ * @param count how many blocks are in homes and the snapshot
+ * @return EXIT_SUCCESS
+ *      -EIO if a block couldn't be written
+ */
+static int write_home(cs1550_disk *disk, long count) {
+    struct Singleton *instance = get_instance();
+    int result = EXIT_SUCCESS;
+
+    long i = 0;
+    while (i < count) {
+        long run_start = i++;
+        while (i < count && instance->homes[i] == instance->homes[i - 1] + 1) {
+            ++i;
+        }
+
+        if (io_pwrite(&instance->io, instance->snapshot + run_start * disk->block_size,
+                      (size_t) (i - run_start) * disk->block_size,
+                      (off_t) instance->homes[run_start] * disk->block_size) != EXIT_SUCCESS) {
+            result = -EIO;
+        }
+    }
+
+    return result;
+}
+
+
+/*
+ * Puts the blocks of a commit that failed back into the dirty maps, so the next commit writes them again; the mapping
+ * still holds what they were to be. Called with the dirty lock held.
+ */
+static void return_blocks(cs1550_disk *disk) {
+    struct Singleton *instance = get_instance();
+
+    long i;
+    for (i = 0; i < (disk->block_count + 7) / 8; ++i) {
+        instance->dirty_count += __builtin_popcount(instance->commit_blocks[i] & ~instance->dirty_blocks[i]);
+        instance->meta_count += __builtin_popcount(instance->commit_meta[i] & ~instance->meta_blocks[i]);
+        instance->dirty_blocks[i] |= instance->commit_blocks[i];
+        instance->meta_blocks[i] |= instance->commit_meta[i];
+        if (instance->commit_blocks[i] != 0) {
+            dirty = true;
+        }
+    }
+}
+
+
+/*
+ * Once a commit is home, hands the pages it wrote back to the kernel unless they have been written to again since,
+ * and clears the maps the commit took over. Only whole pages inside a run are dropped, since a neighbouring block may
+ * still be dirty. A commit that failed gives its maps back to return_blocks() instead. Called with the map lock held
+ * exclusively and the dirty lock held.
+ */
+static void release_blocks(cs1550_disk *disk, int written) {
+    struct Singleton *instance = get_instance();
+    long page_size = sysconf(_SC_PAGESIZE);
+    long per_page = page_size > (long) disk->block_size ? page_size / (long) disk->block_size : 1;
+    unsigned char *blocks = instance->commit_blocks;
+
+    if (!written) {
+        return_blocks(disk);
+    }
+
+    long i = 0;
+    while (written && i < disk->block_count) {
+        if (blocks[i / 8] == 0) {
+            i = (i / 8 + 1) * 8;
+            continue;
+        }
+        if (!(blocks[i / 8] & (1 << (i % 8)))) {
+            ++i;
+            continue;
+        }
+
+        long run_start = i;
+        while (i < disk->block_count && (blocks[i / 8] & (1 << (i % 8)))) {
+            ++i;
+        }
+
+        off_t first_page = ((off_t) run_start * disk->block_size + page_size - 1) / page_size * page_size;
+        off_t last_page = (off_t) i * disk->block_size / page_size * page_size;
+        while (first_page < last_page) {
+            off_t end = first_page;
+            while (end < last_page) {
+                long block = (long) (end / (off_t) disk->block_size);
+                long k;
+                for (k = block; k < block + per_page; ++k) {
+                    if (instance->dirty_blocks[k / 8] & (1 << (k % 8))) {
+                        break;
+                    }
+                }
+                if (k < block + per_page) {
+                    break;
+                }
+                end += page_size;
+            }
+            if (end > first_page) {
+                madvise(disk->image + first_page, (size_t) (end - first_page), MADV_DONTNEED);
+            }
+            first_page = end + page_size;
+        }
+    }
+
+    memset(instance->commit_blocks, 0, (size_t) ((disk->block_count + 7) / 8));
+    memset(instance->commit_meta, 0, (size_t) ((disk->block_count + 7) / 8));
+}
+
+
+int checkpoint_journal(cs1550_disk *disk) {
+    struct Singleton *instance = get_instance();
+    struct cs1550_journal *journal = &instance->journal;
+
+    memset(journal->scratch, 0, disk->block_size);
+    struct cs1550_journal_header *header = (struct cs1550_journal_header *) journal->scratch;
+    header->magic = CS1550_JOURNAL_MAGIC;
+    header->sequence = journal->sequence;
+
+    if (io_sync(&instance->io) != EXIT_SUCCESS ||
+        io_pwrite(&instance->io, journal->scratch, disk->block_size, (off_t) journal->start * disk->block_size) !=
+        EXIT_SUCCESS || io_sync(&instance->io) != EXIT_SUCCESS) {
+        return -EIO;
+    }
+
+    journal->head = 0;
+    memset(journal->logged, 0, (size_t) (disk->block_count + 7) / 8);
+
+    return EXIT_SUCCESS;
+}
+
+
+/*
+ * Appends the copies of a commit's metadata blocks to the ring as one transaction. The caller makes sure it fits and
+ * syncs it.
+ *
+ * @param count how many blocks are in homes and the snapshot
+ */
+static int log_transaction(cs1550_disk *disk, long count) {
+    struct Singleton *instance = get_instance();
+    struct cs1550_journal *journal = &instance->journal;
+    long per_descriptor = (long) HOMES_PER_DESCRIPTOR(disk->block_size);
+    long descriptors = (count + per_descriptor - 1) / per_descriptor;
+    uint64_t checksum = JOURNAL_CHECKSUM_SEED;
+    const long *homes = instance->homes;
+    struct iovec iov[IOV_MAX];
+    int iovcnt = 0;
+    int result = EXIT_SUCCESS;
+
+    // the ring starts right after the header
+    off_t position = (off_t) (journal->start + 1 + journal->head) * disk->block_size;
+
+    long i;
+    for (i = 0; i < count && result == EXIT_SUCCESS; ++i) {
+        // every descriptor is filled in before it goes out
+        if (i % per_descriptor == 0) {
+            struct cs1550_journal_descriptor *descriptor =
+                    (struct cs1550_journal_descriptor *) (journal->scratch + i / per_descriptor * disk->block_size);
+            memset(descriptor, 0, disk->block_size);
+            descriptor->magic = CS1550_DESCRIPTOR_MAGIC;
+            descriptor->sequence = journal->sequence;
+            descriptor->count = (uint32_t) (count - i < per_descriptor ? count - i : per_descriptor);
+
+            long j;
+            for (j = 0; j < (long) descriptor->count; ++j) {
+                descriptor->home[j] = (uint64_t) homes[i + j];
+            }
+
+            iov[iovcnt].iov_base = descriptor;
+            iov[iovcnt].iov_len = disk->block_size;
+            iovcnt++;
+            checksum = journal_checksum(checksum, descriptor, disk->block_size);
+        }
+
+        iov[iovcnt].iov_base = instance->snapshot + i * disk->block_size;
+        iov[iovcnt].iov_len = disk->block_size;
+        iovcnt++;
+        checksum = journal_checksum(checksum, instance->snapshot + i * disk->block_size, disk->block_size);
+
+        // leave room for another descriptor and the commit block
+        if (iovcnt >= IOV_MAX - 2) {
+            result = io_pwritev(&instance->io, iov, iovcnt, position);
+            position += (off_t) iovcnt * disk->block_size;
+            iovcnt = 0;
+        }
+    }
+
+    struct cs1550_journal_commit *commit =
+            (struct cs1550_journal_commit *) (journal->scratch + descriptors * disk->block_size);
+    memset(commit, 0, disk->block_size);
+    commit->magic = CS1550_COMMIT_MAGIC;
+    commit->blocks = (uint32_t) (descriptors + count);
+    commit->sequence = journal->sequence;
+    commit->checksum = checksum;
+
+    if (result == EXIT_SUCCESS) {
+        iov[iovcnt].iov_base = commit;
+        iov[iovcnt].iov_len = disk->block_size;
+        iovcnt++;
+        result = io_pwritev(&instance->io, iov, iovcnt, position);
+    }
+
+    return result;
+}
+
+
+/*
+ * The journalled half of write_to_disk(), once it has the maps and the metadata copies to itself.
+ *
+ * @param count how many metadata blocks are in homes and the snapshot
+ */
+static int commit_transaction(cs1550_disk *disk, long count) {
+    struct Singleton *instance = get_instance();
+    struct cs1550_journal *journal = &instance->journal;
+    long per_descriptor = (long) HOMES_PER_DESCRIPTOR(disk->block_size);
+    long needed = (count + per_descriptor - 1) / per_descriptor + count + 1;
+    int result = EXIT_SUCCESS;
+
+    // a block logged as metadata and since reused for file data must not have the old copy replayed over it, so the
+    // ring is emptied before such a block is written
+    int data = false;
+    long i;
+    for (i = 0; i < (disk->block_count + 7) / 8; ++i) {
+        unsigned char blocks = instance->commit_blocks[i] & ~instance->commit_meta[i];
+        data = data || blocks != 0;
+        if (blocks & journal->logged[i]) {
+            result = checkpoint_journal(disk);
+            break;
+        }
+    }
+
+    // data goes home, and is on the disk, before the metadata that points at it is committed
+    int written = write_back(disk);
+    if (result == EXIT_SUCCESS) {
+        result = written;
+    }
+
+    if (count == 0) {
+        return result;
+    }
+
+    if (needed > journal->blocks) {
+        // more than the whole ring holds; rare with COMMIT_DIRTY_BYTES, and written home unlogged as before
+        if (checkpoint_journal(disk) != EXIT_SUCCESS) {
+            result = -EIO;
+        }
+        written = write_home(disk, count);
+        return result == EXIT_SUCCESS ? written : result;
+    }
+
+    if (needed > journal->blocks - journal->head && checkpoint_journal(disk) != EXIT_SUCCESS) {
+        // the ring can't be reused, so the blocks go home unlogged rather than past its end
+        written = write_home(disk, count);
+        return -EIO;
+    }
+
+    // nothing goes home until the transaction is on the disk, and it isn't logged at all if the data it points at
+    // couldn't be written; either way the blocks still go home, since the mapping already depends on them, just
+    // without the crash guarantee
+    if (result != EXIT_SUCCESS || (data && io_sync(&instance->io) != EXIT_SUCCESS) ||
+        log_transaction(disk, count) != EXIT_SUCCESS || io_sync(&instance->io) != EXIT_SUCCESS) {
+        result = -EIO;
+    } else {
+        for (i = 0; i < count; ++i) {
+            journal->logged[instance->homes[i] / 8] |= 1 << (instance->homes[i] % 8);
+        }
+        journal->head += needed;
+        journal->sequence++;
+    }
+
+    written = write_home(disk, count);
+
+    return result == EXIT_SUCCESS ? written : result;
+}
+
+
+/*
+ * Makes room for a commit's list of metadata blocks and their copies. Called with the map lock held exclusively.
+ *
+ * @return EXIT_SUCCESS
+ *      -ENOMEM if there isn't room
+ */
+static int reserve_snapshot(cs1550_disk *disk, long count) {
+    struct Singleton *instance = get_instance();
+
+    if (count <= instance->snapshot_size) {
+        return EXIT_SUCCESS;
+    }
+
+    // aligned for O_DIRECT
+    void *snapshot;
+    long *homes = malloc((size_t) count * sizeof(long));
+    if (homes == NULL || posix_memalign(&snapshot, (size_t) sysconf(_SC_PAGESIZE),
+                                        (size_t) count * disk->block_size) != 0) {
+        free(homes);
+        return -ENOMEM;
+    }
+
+    free(instance->homes);
+    free(instance->snapshot);
+    instance->homes = homes;
+    instance->snapshot = (char *) snapshot;
+    instance->snapshot_size = count;
+
+    return EXIT_SUCCESS;
+}
+
+
+int write_to_disk(cs1550_disk *disk) {
+    struct Singleton *instance = get_instance();
+    int result = EXIT_SUCCESS;
+
+    // one commit at a time, so the maps it takes over, its copies and the journal are its own
+    pthread_mutex_lock(&instance->commit_lock);
+
+    // operations change the mapping with map_lock shared, so holding it exclusively means the commit takes every
+    // operation so far and nothing of one still under way; it is only held to take the dirty maps over and copy the
+    // metadata, and let go before anything waits on the device
+    pthread_rwlock_wrlock(&instance->map_lock);
+    pthread_mutex_lock(&instance->dirty_lock);
+
+    long count = instance->meta_count;
+    int was_dirty = dirty;
+    if (was_dirty && reserve_snapshot(disk, count) != EXIT_SUCCESS) {
+        // everything stays dirty for the next commit to try again
+        pthread_mutex_unlock(&instance->dirty_lock);
+        pthread_rwlock_unlock(&instance->map_lock);
+        pthread_mutex_unlock(&instance->commit_lock);
+        return -ENOMEM;
+    }
+
+    if (was_dirty) {
+        // the maps the commit hands back are clear, so operations start the next one from nothing
+        unsigned char *blocks = instance->dirty_blocks, *meta = instance->meta_blocks;
+        instance->dirty_blocks = instance->commit_blocks;
+        instance->meta_blocks = instance->commit_meta;
+        instance->commit_blocks = blocks;
+        instance->commit_meta = meta;
+        instance->dirty_count = instance->meta_count = 0;
+    }
+    dirty = false;
+    instance->pending = 0;
+
+    pthread_mutex_unlock(&instance->dirty_lock);
+
+    // the metadata is copied, in block order, so what the journal and the home get is the mapping as it is now
+    long n = 0;
+    long i;
+    for (i = 0; was_dirty && i < disk->block_count && n < count; ++i) {
+        if (instance->commit_meta[i / 8] == 0) {
+            i = (i / 8 + 1) * 8 - 1;
+        } else if (instance->commit_meta[i / 8] & (1 << (i % 8))) {
+            memcpy(instance->snapshot + n * disk->block_size, block_address(disk, i), disk->block_size);
+            instance->homes[n++] = i;
+        }
+    }
+    assert(n == count || !was_dirty);
+
+    pthread_rwlock_unlock(&instance->map_lock);
+
+    if (was_dirty && instance->journal.start != 0) {
+        result = commit_transaction(disk, count);
+    } else if (was_dirty) {
+        int written = write_back(disk);
+        result = write_home(disk, count);
+        if (written != EXIT_SUCCESS) {
+            result = written;
+        }
+
+        // a logged commit is on the disk once it's done; this one only once ".disk" is waited for
+        if (instance->sync == SYNC_STRICT) {
+            int synced = io_sync(&instance->io);
+            if (result == EXIT_SUCCESS) {
+                result = synced;
+            }
+        } else {
+            pthread_mutex_lock(&instance->dirty_lock);
+            instance->unsynced = true;
+            pthread_mutex_unlock(&instance->dirty_lock);
+        }
+    }
+
+    // what went home and hasn't been written to since can go; this needs the mapping to itself again, but only for as
+    // long as that takes
+    pthread_rwlock_wrlock(&instance->map_lock);
+    pthread_mutex_lock(&instance->dirty_lock);
+    release_blocks(disk, result == EXIT_SUCCESS);
+    pthread_mutex_unlock(&instance->dirty_lock);
+    pthread_rwlock_unlock(&instance->map_lock);
+
+    pthread_mutex_unlock(&instance->commit_lock);
+
+    return result;
+}
+
+
+int sync_disk(cs1550_disk *disk) {
+    struct Singleton *instance = get_instance();
+
+    if (instance->sync == SYNC_NONE) {
+        return EXIT_SUCCESS;
+    }
+
+    int result = write_to_disk(disk);
+
+    // a logged commit is on the disk already, but without a journal the blocks it wrote home may not be
+    pthread_mutex_lock(&instance->dirty_lock);
+    int unsynced = instance->unsynced;
+    instance->unsynced = false;
+    pthread_mutex_unlock(&instance->dirty_lock);
+
+    if (unsynced && io_sync(&instance->io) != EXIT_SUCCESS) {
+        result = -EIO;
+    }
+
+    return result;
+}
+
+
+int finish_operation(cs1550_disk *disk) {
+    struct Singleton *instance = get_instance();
+
+    pthread_mutex_lock(&instance->dirty_lock);
+    instance->pending++;
+    int now = instance->journal.start == 0 || instance->sync == SYNC_STRICT || instance->pending >= COMMIT_OPERATIONS ||
+              instance->meta_count >= instance->journal.blocks / 2 ||
+              instance->dirty_count >= (long) (COMMIT_DIRTY_BYTES / disk->block_size);
+    pthread_mutex_unlock(&instance->dirty_lock);
+
+    return now ? write_to_disk(disk) : EXIT_SUCCESS;
+}
+
+
+void *commit_thread(void *arg) {
+    cs1550_disk *disk = (cs1550_disk *) arg;
+    struct Singleton *instance = get_instance();
+
+    pthread_mutex_lock(&instance->dirty_lock);
+    while (!instance->stopping) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += instance->commit_interval / 1000;
+        until.tv_nsec += (instance->commit_interval % 1000) * 1000000L;
+        if (until.tv_nsec >= 1000000000L) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&instance->commit_wake, &instance->dirty_lock, &until);
+
+        // with sync=none, operations wait for a commit until enough of them pile up
+        if (!instance->stopping && dirty == true && instance->sync != SYNC_NONE) {
+            pthread_mutex_unlock(&instance->dirty_lock);
+            write_to_disk(disk);
+            pthread_mutex_lock(&instance->dirty_lock);
+        }
+
+        if (!instance->stopping && instance->unsynced && instance->sync == SYNC_BATCHED) {
+            instance->unsynced = false;
+            pthread_mutex_unlock(&instance->dirty_lock);
+            if (io_sync(&instance->io) != EXIT_SUCCESS) {
+                print_debug(("Waiting for the disk failed\n"));
+            }
+            pthread_mutex_lock(&instance->dirty_lock);
+        }
+    }
+    pthread_mutex_unlock(&instance->dirty_lock);
+
+    return NULL;
+}
+
+
+/*
+ * Brings one window of a file into the page cache. Its extents are looked up under the directory's lock, which is let
+ * go again before anything is read: a block that is freed meanwhile only gets read for nothing.
+ */
+static void readahead_window(cs1550_disk *disk, const struct readahead_request *request) {
+    struct Singleton *instance = get_instance();
+    struct {
+        char *start;
+        size_t length;
+    } ranges[READAHEAD_EXTENTS];
+    int count = 0;
+
+    lock_namespace(false);
+    lock_directory(request->dir_block, false);
+
+    // the slot still holds the file only if its directory hasn't changed since the read that asked for this
+    if (instance->generations[request->dir_block % DIRECTORY_LOCKS] == request->generation) {
+        const struct cs1550_file_directory *file = slot_file(disk, request->slot);
+        off_t offset = request->offset;
+        off_t end = offset + (off_t) request->length < (off_t) file->fsize ? offset + (off_t) request->length
+                                                                            : (off_t) file->fsize;
+        off_t position = 0;
+        long start, blocks;
+        struct extent_iterator it = {0};
+
+        while (offset < end && count < READAHEAD_EXTENTS && next_extent(disk, file, &it, &start, &blocks)) {
+            off_t length = (off_t) blocks * disk->block_size;
+
+            if (offset < position + length) {
+                off_t until = position + length < end ? position + length : end;
+
+                // straight into the image rather than through block_address(): nothing has been read yet
+                ranges[count].start = disk->image + start * disk->block_size + (offset - position);
+                ranges[count].length = (size_t) (until - offset);
+                count++;
+                offset = until;
+            }
+
+            position += length;
+        }
+    }
+
+    unlock_directory(request->dir_block);
+    unlock_namespace();
+
+    size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    int i;
+    for (i = 0; i < count; ++i) {
+        char *first = (char *) ((uintptr_t) ranges[i].start & ~(uintptr_t) (page_size - 1));
+        char *last = ranges[i].start + ranges[i].length;
+
+        // start the reads of the whole range at once, then wait for them here by faulting each page in, so the read
+        // that gets there later finds it mapped
+        madvise(first, (size_t) (last - first), MADV_WILLNEED);
+
+        char *page;
+        for (page = first; page < last; page += page_size) {
+            (void) *(volatile char *) page;
+        }
+
+        instance->readahead_bytes += ranges[i].length;
+    }
+    if (count > 0) {
+        instance->readahead_windows++;
+    }
+}
+
+
+void *readahead_thread(void *arg) {
+    cs1550_disk *disk = (cs1550_disk *) arg;
+    struct Singleton *instance = get_instance();
+
+    pthread_mutex_lock(&instance->readahead_lock);
+    while (!instance->readahead_stopping) {
+        if (instance->readahead_count == 0) {
+            pthread_cond_wait(&instance->readahead_wake, &instance->readahead_lock);
+            continue;
+        }
+
+        struct readahead_request request = instance->readahead_queue[instance->readahead_head];
+        instance->readahead_head = (instance->readahead_head + 1) % READAHEAD_QUEUE;
+        instance->readahead_count--;
+
+        pthread_mutex_unlock(&instance->readahead_lock);
+        readahead_window(disk, &request);
+        pthread_mutex_lock(&instance->readahead_lock);
+    }
+    pthread_mutex_unlock(&instance->readahead_lock);
+
+    return NULL;
+}
+
+
+int replay_journal(const char *disk_path) {
+    struct cs1550_superblock super;
+    int fd = open(disk_path, O_RDWR);
+    int replayed = 0;
+
+    if (fd == -1 || pread(fd, &super, sizeof(super), 0) != (ssize_t) sizeof(super) ||
+        super.magic != CS1550_MAGIC || super.version != CS1550_VERSION || super.journal_blocks < 3 ||
+        super.block_size < MIN_BLOCK_SIZE || super.block_size > MAX_BLOCK_SIZE ||
+        super.journal_start + super.journal_blocks > super.block_count) {
+        // no journal to replay; anything wrong with the superblock is reported once it's mapped
+        if (fd != -1) {
+            close(fd);
+        }
+        return 0;
+    }
+
+    size_t block_size = super.block_size;
+    long ring = (long) super.journal_blocks - 1;
+    long per_descriptor = (long) HOMES_PER_DESCRIPTOR(block_size);
+    char *header_block = malloc(block_size);
+    char *block = malloc(block_size);
+    char *descriptor_block = malloc(block_size);
+    struct cs1550_journal_header *header = (struct cs1550_journal_header *) header_block;
+    struct cs1550_journal_descriptor *descriptor = (struct cs1550_journal_descriptor *) descriptor_block;
+    struct cs1550_journal_commit *commit = (struct cs1550_journal_commit *) descriptor_block;
+    off_t ring_start = (off_t) (super.journal_start + 1) * (off_t) block_size;
+
+    if (pread(fd, header_block, block_size, (off_t) super.journal_start * block_size) != (ssize_t) block_size ||
+        header->magic != CS1550_JOURNAL_MAGIC) {
+        ring = 0;
+    }
+
+    uint64_t sequence = header->sequence;
+    long at = 0;
+    int result = 0;
+    while (at < ring && result == 0) {
+        // first make sure the whole transaction is there: descriptors that follow on, then a commit that matches
+        uint64_t checksum = JOURNAL_CHECKSUM_SEED;
+        long position = at;
+        long blocks = 0;
+        int complete = false;
+
+        while (position < ring) {
+            if (pread(fd, descriptor_block, block_size, ring_start + position * (off_t) block_size) !=
+                (ssize_t) block_size) {
+                break;
+            }
+            if (descriptor->magic == CS1550_COMMIT_MAGIC) {
+                complete = commit->sequence == sequence && commit->blocks == (uint32_t) blocks && blocks > 0 &&
+                           commit->checksum == checksum;
+                position++;
+                break;
+            }
+            if (descriptor->magic != CS1550_DESCRIPTOR_MAGIC || descriptor->sequence != sequence ||
+                descriptor->count == 0 || (long) descriptor->count > per_descriptor ||
+                position + 1 + (long) descriptor->count >= ring) {
+                break;
+            }
+
+            checksum = journal_checksum(checksum, descriptor_block, block_size);
+            long copies = descriptor->count;
+            position++;
+
+            long i;
+            for (i = 0; i < copies; ++i, ++position) {
+                if (pread(fd, block, block_size, ring_start + position * (off_t) block_size) != (ssize_t) block_size) {
+                    break;
+                }
+                checksum = journal_checksum(checksum, block, block_size);
+            }
+            if (i < copies) {
+                break;
+            }
+            blocks += 1 + copies;
+        }
+
+        if (!complete) {
+            break;
+        }
+
+        // then copy each block home
+        long end = position;
+        position = at;
+        while (position < end - 1 && result == 0) {
+            if (pread(fd, descriptor_block, block_size, ring_start + position * (off_t) block_size) !=
+                (ssize_t) block_size) {
+                result = -EIO;
+                break;
+            }
+            position++;
+
+            uint32_t i;
+            for (i = 0; i < descriptor->count; ++i, ++position) {
+                uint64_t home = descriptor->home[i];
+                if (home >= super.block_count ||
+                    pread(fd, block, block_size, ring_start + position * (off_t) block_size) != (ssize_t) block_size ||
+                    pwrite(fd, block, block_size, (off_t) home * block_size) != (ssize_t) block_size) {
+                    result = -EIO;
+                    break;
+                }
+            }
+        }
+
+        if (result == 0) {
+            print_debug(("Replayed journal transaction %llu\n", (unsigned long long) sequence));
+            replayed++;
+            sequence++;
+            at = end;
+        }
+    }
+
+    // the replayed blocks are home for good before the header lets go of them
+    if (replayed > 0 && result == 0) {
+        header->sequence = sequence;
+        if (fdatasync(fd) == -1 ||
+            pwrite(fd, header_block, block_size, (off_t) super.journal_start * block_size) != (ssize_t) block_size ||
+            fdatasync(fd) == -1) {
+            result = -EIO;
+        }
+    }
+
+    free(header_block);
+    free(block);
+    free(descriptor_block);
+    close(fd);
+
+    return result == 0 ? replayed : result;
+}
+
+
+long bitmap_find_zero(const char *bitmap, long start, long end) {
+    if (start >= end) {
+        return -1;
+    }
+
+    long index = start / 64;
+    long last = (end - 1) / 64;
+
+    // ignore the bits in front of start by pretending they are set
+    uint64_t free_bits = ~bitmap_word(bitmap, index) & (~0ULL << (start % 64));
+
+    while (free_bits == 0) {
+        if (++index > last) {
+            return -1;
+        }
+
+#ifdef CS1550_SIMD
+        // step over full stretches 128 bits at a time
+        __m128i full = _mm_set1_epi8((char) 0xff);
+        while (index + 1 <= last &&
+               _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (bitmap + index * 8)), full)) ==
+               0xffff) {
+            index += 2;
+        }
+        if (index > last) {
+            return -1;
+        }
+#endif
+
+        free_bits = ~bitmap_word(bitmap, index);
+    }
+
+    long bit = index * 64 + __builtin_ctzll(free_bits);
+    return bit < end ? bit : -1;
+}
+
+
+long bitmap_find_one(const char *bitmap, long start, long end) {
+    if (start >= end) {
+        return end;
+    }
+
+    long index = start / 64;
+    long last = (end - 1) / 64;
+
+    uint64_t used_bits = bitmap_word(bitmap, index) & (~0ULL << (start % 64));
+
+    while (used_bits == 0) {
+        if (++index > last) {
+            return end;
+        }
+        used_bits = bitmap_word(bitmap, index);
+    }
+
+    long bit = index * 64 + __builtin_ctzll(used_bits);
+    return bit < end ? bit : end;
+}
+
+
+long bitmap_find_zero_run(const char *bitmap, long start, long end, long count) {
+    while (start < end) {
+        long run_start = bitmap_find_zero(bitmap, start, end);
+        if (run_start == -1 || end - run_start < count) {
+            return -1;
+        }
+
+        // the run ends at the next set bit, but there is no need to look past what we asked for
+        long run_end = bitmap_find_one(bitmap, run_start, run_start + count);
+        if (run_end - run_start >= count) {
+            return run_start;
+        }
+
+        start = run_end;
+    }
+
+    return -1;
+}
+
+
+long get_free_block(cs1550_disk *disk) {
+    struct Singleton *instance = get_instance();
+
+    print_debug(("Getting free block starting index at: %ld\n", instance->free_hint));
+
+    // seek until I find the first free bit
+    // superblock, bitmap and root are marked used when the disk is formatted
+    long i = bitmap_find_zero(disk->bitmap, instance->free_hint, disk->block_count);
+    if (i == -1) {
+        return disk->block_count;
+    }
+
+    // nothing in front of the first free bit can become free again without release_free_blocks() saying so
+    instance->free_hint = i;
+    print_debug(("Free block at: %ld\n", i));
+
+    return i;
+}
+
+
+void release_free_blocks(long offset) {
+    struct Singleton *instance = get_instance();
+
+    if (offset < instance->free_hint) {
+        instance->free_hint = offset < 0 ? 0 : offset;
+    }
+}
+
+
+long get_free_run(cs1550_disk *disk, long count) {
+    struct Singleton *instance = get_instance();
+
+    print_debug(("Getting %ld free blocks starting index at: %ld\n", count, instance->free_hint));
+
+    long i = bitmap_find_zero_run(disk->bitmap, instance->free_hint, disk->block_count, count);
+    if (i == -1) {
+        return -1;
+    }
+
+    // only move the hint when nothing free was skipped on the way to the run
+    if (bitmap_find_zero(disk->bitmap, instance->free_hint, i) == -1) {
+        instance->free_hint = i;
+    }
+    print_debug(("Free run at: %ld\n", i));
+
+    return i;
+}
+
+
+long reserve_free_blocks(long count, int partial) {
+    struct Singleton *instance = get_instance();
+    long reserved = 0;
+
+    pthread_mutex_lock(&instance->alloc_lock);
+    if (count > 0 && (partial || count <= instance->free_blocks)) {
+        reserved = count < instance->free_blocks ? count : instance->free_blocks;
+        instance->free_blocks -= reserved;
+    }
+    pthread_mutex_unlock(&instance->alloc_lock);
+
+    return reserved;
+}
+
+
+void unreserve_free_blocks(long count) {
+    struct Singleton *instance = get_instance();
+
+    pthread_mutex_lock(&instance->alloc_lock);
+    instance->free_blocks += count;
+    pthread_mutex_unlock(&instance->alloc_lock);
+}
+
+
+long get_directory_block(cs1550_disk *disk) {
+    struct cs1550_superblock *super = disk->super;
+    long block;
+
+    pthread_mutex_lock(&get_instance()->alloc_lock);
+
+    if (super->dir_pool_next < super->dir_pool_end) {
+        // pool blocks are already marked used and zeroed, so taking one only moves the pool along
+        block = (long) super->dir_pool_next++;
+        mark_dirty(disk, super, sizeof(struct cs1550_superblock));
+    } else {
+        block = get_free_run(disk, 1);
+        if (block != -1) {
+            set_bit_map(block, 1, 1, disk->bitmap);
+            mark_dirty(disk, &disk->bitmap[block / 8], 1);
+        }
+    }
+
+    pthread_mutex_unlock(&get_instance()->alloc_lock);
+
+    return block;
+}
+
+
+int next_extent(cs1550_disk *disk, const struct cs1550_file_directory *file, struct extent_iterator *it,
+                long *start, long *count) {
+    if (!it->started) {
+        it->started = true;
+        it->block = file->nExtentBlock;
+        it->index = 0;
+
+        if (file->nBlocks > 0) {
+            *start = file->nStartBlock;
+            *count = file->nBlocks;
+            return true;
+        }
+    }
+
+    while (it->block != 0) {
+        cs1550_extent_block *extents = (cs1550_extent_block *) block_address(disk, it->block);
+
+        if (it->index < extents->nExtents) {
+            *start = extents->extents[it->index].nStartBlock;
+            *count = extents->extents[it->index].nBlocks;
+            it->index++;
+            return true;
+        }
+
+        it->block = extents->nNext;
+        it->index = 0;
+    }
+
+    return false;
+}
+
+
+/*
+ * Hands out up to count blocks and records them as the next extent of file, growing its last extent in place when the
+ * blocks right after it are free.
+ *
+ * @return how many blocks were added, 0 if the disk is full
+ *      -ENOSPC if the extent list itself can't grow
+ */
+static long add_extent(cs1550_disk *disk, cs1550_directory_entry *entry, struct cs1550_file_directory *file,
+                       long count) {
+    // find the last extent: it's either the inline one or the last slot of the last extent block
+    cs1550_extent_block *last_block = NULL;
+    struct cs1550_extent *last = NULL;
+
+    long block = file->nExtentBlock;
+    while (block != 0) {
+        last_block = (cs1550_extent_block *) block_address(disk, block);
+        block = last_block->nNext;
+    }
+
+    long last_start = file->nStartBlock;
+    long last_count = file->nBlocks;
+    if (last_block != NULL && last_block->nExtents > 0) {
+        last = &last_block->extents[last_block->nExtents - 1];
+        last_start = last->nStartBlock;
+        last_count = last->nBlocks;
+    }
+
+    // first choice: keep the file sequential by taking the blocks right behind its last extent
+    if (last_count > 0) {
+        long end = last_start + last_count;
+        long limit = end + count < disk->block_count ? end + count : disk->block_count;
+        long grown = bitmap_find_one(disk->bitmap, end, limit) - end;
+
+        if (grown > 0) {
+            set_bit_map(end, grown, 1, disk->bitmap);
+            mark_dirty(disk, &disk->bitmap[end / 8], (end + grown - 1) / 8 - end / 8 + 1);
+            if (last != NULL) {
+                last->nBlocks += grown;
+                mark_dirty(disk, last_block, disk->block_size);
+            } else {
+                file->nBlocks += grown;
+                mark_dirty(disk, entry, disk->block_size);
+            }
+            return grown;
+        }
+    }
+
+    // a file past its first extent may need a fresh extent block chained on; reserve it before looking for data so
+    // the two can't land on the same block
+    long new_block = 0;
+    if (file->nBlocks != 0 && (last_block == NULL || last_block->nExtents == (int) MAX_EXTENTS_IN_BLOCK(disk))) {
+        new_block = get_free_block(disk);
+        if (new_block >= disk->block_count) {
+            return -ENOSPC;
+        }
+        set_bit_map(new_block, 1, 1, disk->bitmap);
+    }
+
+    // otherwise a new extent: the whole request in one piece if possible, else the first free stretch there is
+    long start = get_free_run(disk, count);
+    if (start == -1) {
+        start = get_free_block(disk);
+        if (start >= disk->block_count) {
+            if (new_block != 0) {
+                set_bit_map(new_block, 1, 0, disk->bitmap);
+            }
+            return 0;
+        }
+        count = bitmap_find_one(disk->bitmap, start, start + count < disk->block_count ? start + count
+                                                                                     : disk->block_count) - start;
+    }
+
+    if (file->nBlocks == 0) {
+        file->nStartBlock = start;
+        file->nBlocks = count;
+    } else {
+        if (new_block != 0) {
+            mark_dirty(disk, &disk->bitmap[new_block / 8], 1);
+
+            cs1550_extent_block *extents = (cs1550_extent_block *) block_address(disk, new_block);
+            memset(extents, 0, disk->block_size);
+            mark_dirty(disk, extents, disk->block_size);
+
+            if (last_block == NULL) {
+                file->nExtentBlock = new_block;
+                mark_dirty(disk, entry, disk->block_size);
+            } else {
+                last_block->nNext = new_block;
+                mark_dirty(disk, last_block, disk->block_size);
+            }
+            last_block = extents;
+        }
+
+        last_block->extents[last_block->nExtents].nStartBlock = start;
+        last_block->extents[last_block->nExtents].nBlocks = count;
+        last_block->nExtents++;
+        mark_dirty(disk, last_block, disk->block_size);
+    }
+
+    set_bit_map(start, count, 1, disk->bitmap);
+    mark_dirty(disk, &disk->bitmap[start / 8], (start + count - 1) / 8 - start / 8 + 1);
+    mark_dirty(disk, entry, disk->block_size);
+
+    return count;
+}
+
+
+int grow_file(cs1550_disk *disk, cs1550_directory_entry *entry, struct cs1550_file_directory *file, size_t size) {
+    long have = 0;
+    long start, count;
+    struct extent_iterator it = {0};
+    while (next_extent(disk, file, &it, &start, &count)) {
+        have += count;
+    }
+
+    long need = (long) ((size + disk->block_size - 1) / disk->block_size);
+    long more = need - have;
+    int result = 0;
+
+    pthread_mutex_lock(&get_instance()->alloc_lock);
+
+    // fail up front rather than leave the file half grown
+    if (more > get_instance()->free_blocks) {
+        more = 0;
+        result = -ENOSPC;
+    }
+
+    while (more > 0) {
+        long before = have;
+        long added = add_extent(disk, entry, file, more);
+        if (added <= 0) {
+            result = added < 0 ? (int) added : -ENOSPC;
+            break;
+        }
+
+        // a file never shows stale data, so the new blocks start out zeroed
+        it = (struct extent_iterator) {0};
+        long seen = 0;
+        while (next_extent(disk, file, &it, &start, &count)) {
+            if (seen + count > before) {
+                long skip = before > seen ? before - seen : 0;
+                memset(block_address(disk, start + skip), 0, (size_t) (count - skip) * disk->block_size);
+                mark_data_dirty(disk, block_address(disk, start + skip), (size_t) (count - skip) * disk->block_size);
+            }
+            seen += count;
+        }
+
+        have += added;
+        more -= added;
+    }
+
+    pthread_mutex_unlock(&get_instance()->alloc_lock);
+
+    if (result == 0) {
+        file->fsize = size;
+        mark_dirty(disk, entry, disk->block_size);
+    }
+
+    return result;
+}
+
+
+/*
+ * Keeps the first keep blocks of an extent and frees the rest.
+ *
+ * @return how many blocks were kept
+ */
+static long trim_extent(cs1550_disk *disk, long start, long count, long keep) {
+    keep = keep < 0 ? 0 : keep < count ? keep : count;
+
+    if (keep < count) {
+        set_bit_map(start + keep, count - keep, 0, disk->bitmap);
+        mark_dirty(disk, &disk->bitmap[(start + keep) / 8], (start + count - 1) / 8 - (start + keep) / 8 + 1);
+    }
+
+    return keep;
+}
+
+
+void shrink_file(cs1550_disk *disk, cs1550_directory_entry *entry, struct cs1550_file_directory *file, size_t size) {
+    long keep = (long) ((size + disk->block_size - 1) / disk->block_size);
+    long last = -1;    //block the new end of the file falls in
+
+    assert(size <= file->fsize);
+
+    pthread_mutex_lock(&get_instance()->alloc_lock);
+
+    long kept = trim_extent(disk, file->nStartBlock, file->nBlocks, keep);
+    if (kept > 0) {
+        last = file->nStartBlock + kept - 1;
+    } else {
+        file->nStartBlock = 0;
+    }
+    file->nBlocks = kept;
+    keep -= kept;
+
+    // the extent block the new end falls in is cut short and every one after it goes back whole
+    cs1550_extent_block *previous = NULL;
+    long block = file->nExtentBlock;
+    while (block != 0) {
+        cs1550_extent_block *extents = (cs1550_extent_block *) block_address(disk, block);
+        long next = extents->nNext;
+        int used = 0;
+        int changed = false;
+
+        int i;
+        for (i = 0; i < extents->nExtents; ++i) {
+            long start = extents->extents[i].nStartBlock;
+            long count = extents->extents[i].nBlocks;
+
+            kept = trim_extent(disk, start, count, keep);
+            if (kept > 0) {
+                last = start + kept - 1;
+                used = i + 1;
+            }
+            if (kept < count) {
+                extents->extents[i].nBlocks = kept;
+                changed = true;
+            }
+            keep -= kept;
+        }
+
+        if (used == 0) {
+            set_bit_map(block, 1, 0, disk->bitmap);
+            mark_dirty(disk, &disk->bitmap[block / 8], 1);
+
+            if (previous == NULL) {
+                file->nExtentBlock = 0;
+            } else {
+                previous->nNext = 0;
+                mark_dirty(disk, previous, disk->block_size);
+            }
+        } else {
+            if (changed) {
+                extents->nExtents = used;
+                mark_dirty(disk, extents, disk->block_size);
+            }
+            previous = extents;
+        }
+
+        block = next;
+    }
+
+    pthread_mutex_unlock(&get_instance()->alloc_lock);
+
+    size_t tail = size % disk->block_size;
+    if (last != -1 && tail != 0) {
+        memset(block_address(disk, last) + tail, 0, disk->block_size - tail);
+        mark_data_dirty(disk, block_address(disk, last) + tail, disk->block_size - tail);
+    }
+
+    file->fsize = size;
+    mark_dirty(disk, entry, disk->block_size);
+}
+
+
+void file_io(cs1550_disk *disk, const struct cs1550_file_directory *file, char *buf, size_t size, off_t offset,
+             int write, struct extent_cursor *cursor) {
+    long start, count;
+    off_t position = 0;
+    struct extent_iterator it = {0};
+
+    // sequential I/O lands in the extent it left off in, or the one after
+    if (cursor != NULL && cursor->position <= offset) {
+        it = cursor->it;
+        position = cursor->position;
+    }
+
+    struct extent_iterator before = it;
+    while (size > 0 && next_extent(disk, file, &it, &start, &count)) {
+        off_t length = (off_t) count * disk->block_size;
+
+        if (offset < position + length) {
+            if (cursor != NULL) {
+                cursor->it = before;
+                cursor->position = position;
+            }
+
+            // copy the part of [offset, offset + size) that falls inside this extent
+            off_t skip = offset - position;
+            size_t chunk = (size_t) (length - skip) < size ? (size_t) (length - skip) : size;
+            char *data = block_address(disk, start) + skip;
+
+            if (write) {
+                memcpy(data, buf, chunk);
+                mark_data_dirty(disk, data, chunk);
+            } else {
+                memcpy(buf, data, chunk);
+            }
+
+            buf += chunk;
+            offset += chunk;
+            size -= chunk;
+        }
+
+        position += length;
+        before = it;
+    }
+}
+
+
+/*
+ * Mixes the directory block into the NAME_HASH of a name, so the same name in different directories lands in
+ * different buckets.
+ */
+static inline uint32_t index_hash(long dir_block, uint32_t name_hash) {
+    return name_hash ^ (uint32_t) (((uint64_t) dir_block * 0x9e3779b97f4a7c15ULL) >> 32);
+}
+
+
+static struct name_index_node **index_find(const struct name_index *index, uint32_t hash, long dir_block,
+                                           const struct path_view *name) {
+    if (index->bucket_count == 0) {
+        return NULL;
+    }
+
+    // the hash and length rule out nearly every other name before a byte of it is looked at
+    struct name_index_node **link = &index->buckets[hash & (index->bucket_count - 1)];
+    for (; *link != NULL; link = &(*link)->next) {
+        struct name_index_node *node = *link;
+        if (node->hash == hash && node->length == name->length && node->dir_block == dir_block &&
+            memcmp(node->name, name->start, (size_t) name->length) == 0) {
+            return link;
+        }
+    }
+
+    return NULL;
+}
+
+
+long index_lookup(struct name_index *index, long dir_block, const struct path_view *name) {
+    uint32_t hash = index_hash(dir_block, NAME_HASH(name->start, name->length));
+
+    pthread_rwlock_rdlock(&index->lock);
+    struct name_index_node **link = index_find(index, hash, dir_block, name);
+    long value = link != NULL ? (*link)->value : -1;
+    pthread_rwlock_unlock(&index->lock);
+
+    return value;
+}
+
+
+void index_insert(struct name_index *index, long dir_block, const struct path_view *name, uint32_t name_hash,
+                  long value) {
+    assert(name->length <= MAX_NAME);
+
+    struct name_index_node *node = malloc(sizeof(struct name_index_node) + (size_t) name->length);
+    node->hash = index_hash(dir_block, name_hash);
+    node->dir_block = dir_block;
+    node->value = value;
+    node->length = name->length;
+    memcpy(node->name, name->start, (size_t) name->length);
+
+    pthread_rwlock_wrlock(&index->lock);
+
+    if (index->count >= index->bucket_count) {
+        // rehash into twice as many buckets; the hash is kept in each node so names aren't hashed again
+        long bucket_count = index->bucket_count == 0 ? 64 : index->bucket_count * 2;
+        struct name_index_node **buckets = calloc((size_t) bucket_count, sizeof(struct name_index_node *));
+
+        long i;
+        for (i = 0; i < index->bucket_count; ++i) {
+            struct name_index_node *next, *old = index->buckets[i];
+            for (; old != NULL; old = next) {
+                next = old->next;
+                old->next = buckets[old->hash & (bucket_count - 1)];
+                buckets[old->hash & (bucket_count - 1)] = old;
+            }
+        }
+
+        free(index->buckets);
+        index->buckets = buckets;
+        index->bucket_count = bucket_count;
+    }
+
+    node->next = index->buckets[node->hash & (index->bucket_count - 1)];
+    index->buckets[node->hash & (index->bucket_count - 1)] = node;
+    index->count++;
+
+    pthread_rwlock_unlock(&index->lock);
+}
+
+
+void index_remove(struct name_index *index, long dir_block, const struct path_view *name) {
+    uint32_t hash = index_hash(dir_block, NAME_HASH(name->start, name->length));
+
+    pthread_rwlock_wrlock(&index->lock);
+
+    struct name_index_node **link = index_find(index, hash, dir_block, name);
+    if (link != NULL) {
+        struct name_index_node *node = *link;
+        *link = node->next;
+        free(node);
+        index->count--;
+    }
+
+    pthread_rwlock_unlock(&index->lock);
+}
+
+
+void index_free(struct name_index *index) {
+    long i;
+    for (i = 0; i < index->bucket_count; ++i) {
+        struct name_index_node *node = index->buckets[i];
+        while (node != NULL) {
+            struct name_index_node *next = node->next;
+            free(node);
+            node = next;
+        }
+    }
+
+    free(index->buckets);
+    index->buckets = NULL;
+    index->bucket_count = 0;
+    index->count = 0;
+}
+
+
+/*
+ * FNV-1a over a whole path, as NAME_HASH() does over a name.
+ */
+static uint32_t path_hash(const struct path_view *path) {
+    uint32_t hash = 2166136261u;
+    int i;
+
+    for (i = 0; i < path->length; ++i) {
+        hash = (hash ^ (uint8_t) path->start[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+
+static struct dentry **dentry_find(const struct dentry_cache *cache, uint32_t hash, const struct path_view *path) {
+    if (cache->bucket_count == 0) {
+        return NULL;
+    }
+
+    struct dentry **link = &cache->buckets[hash & (cache->bucket_count - 1)];
+    for (; *link != NULL; link = &(*link)->next) {
+        struct dentry *dentry = *link;
+        if (dentry->hash == hash && dentry->length == path->length &&
+            memcmp(dentry->path, path->start, (size_t) path->length) == 0) {
+            return link;
+        }
+    }
+
+    return NULL;
+}
+
+
+long dentry_lookup(struct dentry_cache *cache, const struct path_view *path) {
+    pthread_rwlock_rdlock(&cache->lock);
+    struct dentry **link = dentry_find(cache, path_hash(path), path);
+    long dir_block = link != NULL ? (*link)->dir_block : -1;
+    pthread_rwlock_unlock(&cache->lock);
+
+    return dir_block;
+}
+
+
+void dentry_insert(struct dentry_cache *cache, const struct path_view *path, long dir_block) {
+    uint32_t hash = path_hash(path);
+
+    pthread_rwlock_wrlock(&cache->lock);
+
+    // two lookups of the same path can both miss and both walk it
+    if (dentry_find(cache, hash, path) != NULL) {
+        pthread_rwlock_unlock(&cache->lock);
+        return;
+    }
+
+    if (cache->count >= cache->bucket_count) {
+        // same growth as the name indexes
+        long bucket_count = cache->bucket_count == 0 ? 64 : cache->bucket_count * 2;
+        struct dentry **buckets = calloc((size_t) bucket_count, sizeof(struct dentry *));
+
+        long i;
+        for (i = 0; i < cache->bucket_count; ++i) {
+            struct dentry *dentry = cache->buckets[i];
+            while (dentry != NULL) {
+                struct dentry *next = dentry->next;
+                dentry->next = buckets[dentry->hash & (bucket_count - 1)];
+                buckets[dentry->hash & (bucket_count - 1)] = dentry;
+                dentry = next;
+            }
+        }
+
+        free(cache->buckets);
+        cache->buckets = buckets;
+        cache->bucket_count = bucket_count;
+    }
+
+    struct dentry *dentry = malloc(sizeof(struct dentry) + (size_t) path->length);
+    dentry->hash = hash;
+    dentry->dir_block = dir_block;
+    dentry->length = path->length;
+    memcpy(dentry->path, path->start, (size_t) path->length);
+
+    dentry->next = cache->buckets[hash & (cache->bucket_count - 1)];
+    cache->buckets[hash & (cache->bucket_count - 1)] = dentry;
+    cache->count++;
+
+    pthread_rwlock_unlock(&cache->lock);
+}
+
+
+void dentry_remove(struct dentry_cache *cache, const struct path_view *path) {
+    pthread_rwlock_wrlock(&cache->lock);
+
+    struct dentry **link = dentry_find(cache, path_hash(path), path);
+    if (link != NULL) {
+        struct dentry *dentry = *link;
+        *link = dentry->next;
+        free(dentry);
+        cache->count--;
+    }
+
+    pthread_rwlock_unlock(&cache->lock);
+}
+
+
+void dentry_free(struct dentry_cache *cache) {
+    long i;
+    for (i = 0; i < cache->bucket_count; ++i) {
+        struct dentry *dentry = cache->buckets[i];
+        while (dentry != NULL) {
+            struct dentry *next = dentry->next;
+            free(dentry);
+            dentry = next;
+        }
+    }
+
+    free(cache->buckets);
+    cache->buckets = NULL;
+    cache->bucket_count = 0;
+    cache->count = 0;
+}
+
+
+/*
+ * A file is placed by its slot, a directory by its first block made negative; slots of entries are never negative
+ * or 0, so the two can't meet.
+ */
+static inline long inode_key(long dir_block, long slot) {
+    return slot == -1 ? -dir_block : slot;
+}
+
+
+static inline long inode_bucket(const struct inode_table *table, uint64_t key) {
+    return (long) ((key * 0x9e3779b97f4a7c15ULL) >> 32) & (table->bucket_count - 1);
+}
+
+
+static struct inode_node **inode_find_number(const struct inode_table *table, ino_t ino) {
+    if (table->bucket_count == 0) {
+        return NULL;
+    }
+
+    struct inode_node **link = &table->by_number[inode_bucket(table, ino)];
+    while (*link != NULL && (*link)->ino != ino) {
+        link = &(*link)->next_number;
+    }
+
+    return *link != NULL ? link : NULL;
+}
+
+
+static struct inode_node **inode_find_place(const struct inode_table *table, long key) {
+    if (table->bucket_count == 0) {
+        return NULL;
+    }
+
+    struct inode_node **link = &table->by_place[inode_bucket(table, (uint64_t) key)];
+    while (*link != NULL && inode_key((*link)->dir_block, (*link)->slot) != key) {
+        link = &(*link)->next_place;
+    }
+
+    return *link != NULL ? link : NULL;
+}
+
+
+void inode_insert(struct inode_table *table, ino_t ino, long dir_block, long slot, long parent) {
+    struct inode_node *node = malloc(sizeof(struct inode_node));
+    node->ino = ino;
+    node->dir_block = dir_block;
+    node->slot = slot;
+    node->parent = parent;
+
+    pthread_rwlock_wrlock(&table->lock);
+
+    if (table->count >= table->bucket_count) {
+        // same growth as the name indexes, both ways at once; every node is on one chain of each
+        struct inode_node **old = table->by_number, **old_place = table->by_place;
+        long old_count = table->bucket_count;
+        table->bucket_count = old_count == 0 ? 64 : old_count * 2;
+        table->by_number = calloc((size_t) table->bucket_count, sizeof(struct inode_node *));
+        table->by_place = calloc((size_t) table->bucket_count, sizeof(struct inode_node *));
+
+        long i;
+        for (i = 0; i < old_count; ++i) {
+            struct inode_node *next, *moving = old[i];
+            for (; moving != NULL; moving = next) {
+                next = moving->next_number;
+                long number = inode_bucket(table, moving->ino);
+                long place = inode_bucket(table, (uint64_t) inode_key(moving->dir_block, moving->slot));
+                moving->next_number = table->by_number[number];
+                table->by_number[number] = moving;
+                moving->next_place = table->by_place[place];
+                table->by_place[place] = moving;
+            }
+        }
+
+        free(old);
+        free(old_place);
+    }
+
+    long number = inode_bucket(table, ino);
+    long place = inode_bucket(table, (uint64_t) inode_key(dir_block, slot));
+    node->next_number = table->by_number[number];
+    table->by_number[number] = node;
+    node->next_place = table->by_place[place];
+    table->by_place[place] = node;
+    table->count++;
+    if (ino >= table->next) {
+        table->next = ino + 1;    //one read from the image
+    }
+
+    pthread_rwlock_unlock(&table->lock);
+}
+
+
+ino_t inode_next(struct inode_table *table) {
+    pthread_rwlock_wrlock(&table->lock);
+    ino_t ino = table->next++;
+    pthread_rwlock_unlock(&table->lock);
+
+    return ino;
+}
+
+
+ino_t inode_number(struct inode_table *table, long dir_block, long slot) {
+    if (dir_block == 0 && slot == -1) {
+        return ROOT_INODE;
+    }
+
+    pthread_rwlock_rdlock(&table->lock);
+    struct inode_node **link = inode_find_place(table, inode_key(dir_block, slot));
+    ino_t ino = link != NULL ? (*link)->ino : 0;
+    pthread_rwlock_unlock(&table->lock);
+
+    return ino;
+}
+
+
+int inode_place(struct inode_table *table, ino_t ino, long *dir_block, long *slot) {
+    if (ino == ROOT_INODE) {
+        *dir_block = 0;
+        *slot = -1;
+        return 0;
+    }
+
+    pthread_rwlock_rdlock(&table->lock);
+    struct inode_node **link = inode_find_number(table, ino);
+    if (link != NULL) {
+        *dir_block = (*link)->dir_block;
+        *slot = (*link)->slot;
+    }
+    pthread_rwlock_unlock(&table->lock);
+
+    return link != NULL ? 0 : -ENOENT;
+}
+
+
+ino_t inode_parent(struct inode_table *table, ino_t ino) {
+    if (ino == ROOT_INODE) {
+        return ROOT_INODE;
+    }
+
+    pthread_rwlock_rdlock(&table->lock);
+    struct inode_node **link = inode_find_number(table, ino);
+    long parent = link != NULL ? (*link)->parent : -1;
+    pthread_rwlock_unlock(&table->lock);
+
+    // a directory can't go while something is in it, so its number is still there
+    return parent != -1 ? inode_number(table, parent, -1) : 0;
+}
+
+
+void inode_move(struct inode_table *table, long from, long to) {
+    pthread_rwlock_wrlock(&table->lock);
+
+    // only its place changes, so it stays on the same chain by number
+    struct inode_node **link = inode_find_place(table, from);
+    if (link != NULL) {
+        struct inode_node *node = *link;
+        *link = node->next_place;
+
+        node->slot = to;
+        long place = inode_bucket(table, (uint64_t) to);
+        node->next_place = table->by_place[place];
+        table->by_place[place] = node;
+    }
+
+    pthread_rwlock_unlock(&table->lock);
+}
+
+
+void inode_remove(struct inode_table *table, long dir_block, long slot) {
+    pthread_rwlock_wrlock(&table->lock);
+
+    struct inode_node **link = inode_find_place(table, inode_key(dir_block, slot));
+    if (link != NULL) {
+        struct inode_node *node = *link;
+        *link = node->next_place;
+        link = inode_find_number(table, node->ino);
+        *link = node->next_number;
+        free(node);
+        table->count--;
+    }
+
+    pthread_rwlock_unlock(&table->lock);
+}
+
+
+void inode_free(struct inode_table *table) {
+    long i;
+    for (i = 0; i < table->bucket_count; ++i) {
+        struct inode_node *node = table->by_number[i];
+        while (node != NULL) {
+            struct inode_node *next = node->next_number;
+            free(node);
+            node = next;
+        }
+    }
+
+    free(table->by_number);
+    free(table->by_place);
+    table->by_number = NULL;
+    table->by_place = NULL;
+    table->bucket_count = 0;
+    table->count = 0;
+}
+
+
+/*
+ * @return the inode number the image keeps for a directory or file, or a new one if it keeps none
+ */
+static ino_t entry_inode(cs1550_disk *disk, long dir_block, long slot) {
+    struct cs1550_attributes *attributes = entry_attributes(disk, dir_block, slot);
+
+    return attributes != NULL ? (ino_t) attributes->nInode : inode_next(&get_instance()->inodes);
+}
+
+
+void build_index(cs1550_disk *disk) {
+    struct Singleton *instance = get_instance();
+    char buf[MAX_NAME + 1];
+
+    // directories still to go through; the tree is walked without recursion, so its depth doesn't matter
+    long pending_count = 0, pending_size = 64;
+    long *pending = malloc((size_t) pending_size * sizeof(long));
+
+    long root_block;
+    for (root_block = disk->root_block; root_block != 0; root_block = next_directory_block(disk, root_block)) {
+        struct cs1550_root_directory *root = (struct cs1550_root_directory *) block_address(disk, root_block);
+
+        int i;
+        for (i = 0; i < root->nDirectories; ++i) {
+            long dir_block = root->directories[i].nStartBlock;
+            struct path_view dname = {buf, root_name(disk, &root->directories[i], buf)};
+            index_insert(&instance->directories, 0, &dname, NAME_HASH(dname.start, dname.length), dir_block);
+            inode_insert(&instance->inodes, entry_inode(disk, dir_block, -1), dir_block, -1, 0);
+
+            if (pending_count == pending_size) {
+                pending_size *= 2;
+                pending = realloc(pending, (size_t) pending_size * sizeof(long));
+            }
+            pending[pending_count++] = dir_block;
+        }
+    }
+
+    while (pending_count > 0) {
+        long dir_block = pending[--pending_count];
+
+        long block;
+        for (block = dir_block; block != 0; block = next_directory_block(disk, block)) {
+            cs1550_directory_entry *entry = (cs1550_directory_entry *) block_address(disk, block);
+            int m;
+            for (m = 0; m < entry->nFiles; ++m) {
+                struct cs1550_file_directory *file = &entry->files[m];
+                struct path_view fname = {buf, entry_name(disk, file, buf)};
+                index_insert(&instance->files, dir_block, &fname, file->nameHash, make_slot(block, m));
+
+                if (IS_SUBDIRECTORY(file)) {
+                    index_insert(&instance->directories, dir_block, &fname, file->nameHash, file->nStartBlock);
+                    inode_insert(&instance->inodes, entry_inode(disk, file->nStartBlock, -1), file->nStartBlock, -1,
+                                 dir_block);
+
+                    if (pending_count == pending_size) {
+                        pending_size *= 2;
+                        pending = realloc(pending, (size_t) pending_size * sizeof(long));
+                    }
+                    pending[pending_count++] = file->nStartBlock;
+                } else {
+                    inode_insert(&instance->inodes, entry_inode(disk, dir_block, make_slot(block, m)), dir_block,
+                                 make_slot(block, m), dir_block);
+                }
+            }
+        }
+    }
+
+    free(pending);
+}
+
+
+long find_directory(cs1550_disk *disk, long parent, const struct path_view *dir_name) {
+    (void) disk;
+
+    if (check_name(dir_name) != 0) {
+        return -1;
+    }
+
+    return index_lookup(&get_instance()->directories, parent, dir_name);
+}
+
+
+long resolve_directory(cs1550_disk *disk, const struct path_view *path) {
+    struct dentry_cache *cache = &get_instance()->dentries;
+
+    if (path->length == 0) {
+        return 0;
+    }
+
+    long dir_block = dentry_lookup(cache, path);
+    if (dir_block != -1) {
+        return dir_block;
+    }
+
+    // walk it a name at a time, so the directories above are cached as well
+    const char *p = path->start;
+    const char *end = path->start + path->length;
+    dir_block = 0;
+    while (p < end && dir_block != -1) {
+        while (p < end && *p == '/') {
+            p++;
+        }
+        const char *start = p;
+        while (p < end && *p != '/') {
+            p++;
+        }
+        if (p == start) {
+            break;
+        }
+
+        struct path_view name = {start, (int) (p - start)};
+        dir_block = find_directory(disk, dir_block, &name);
+        if (dir_block != -1) {
+            struct path_view prefix = {path->start, (int) (p - path->start)};
+            dentry_insert(cache, &prefix, dir_block);
+        }
+    }
+
+    return dir_block;
+}
+
+
+long find_entry(cs1550_disk *disk, long dir_block, const struct path_view *name) {
+    (void) disk;
+
+    if (check_name(name) != 0) {
+        return -1;
+    }
+
+    return index_lookup(&get_instance()->files, dir_block, name);
+}
+
+
+long find_file(cs1550_disk *disk, long dir_block, const struct path_view *name) {
+    long slot = find_entry(disk, dir_block, name);
+
+    return slot != -1 && !IS_SUBDIRECTORY(slot_file(disk, slot)) ? slot : -1;
+}
+
+
+int check_name(const struct path_view *name) {
+    return name->length <= MAX_NAME ? 0 : -ENAMETOOLONG;
+}
+
+
+int entry_name(cs1550_disk *disk, const struct cs1550_file_directory *file, char *buf) {
+    struct cs1550_name_block *names = (struct cs1550_name_block *) block_address(disk, NAME_BLOCK(file->nameLocation));
+    int length = file->nameLength;
+
+    memcpy(buf, names->names + NAME_OFFSET(file->nameLocation), (size_t) length);
+    buf[length] = '\0';
+    return length;
+}
+
+
+int root_name(cs1550_disk *disk, const struct cs1550_directory *directory, char *buf) {
+    struct cs1550_name_block *names =
+            (struct cs1550_name_block *) block_address(disk, NAME_BLOCK(directory->nameLocation));
+    int length = directory->nameLength;
+
+    memcpy(buf, names->names + NAME_OFFSET(directory->nameLocation), (size_t) length);
+    buf[length] = '\0';
+    return length;
+}
+
+
+void parse_path(const char *path, struct path_info *info) {
+    memset(info, 0, sizeof(struct path_info));
+
+    const char *p = path;
+    const char *last = NULL;
+    const char *last_end = p;
+    while (*p != '\0') {
+        // skip the slashes in front of the next name
+        while (*p == '/') {
+            p++;
+        }
+        if (*p == '\0') {
+            break;
+        }
+
+        const char *start = p;
+        while (*p != '\0' && *p != '/') {
+            p++;
+        }
+
+        info->components++;
+        last = start;
+        last_end = p;
+    }
+
+    // the parent runs up to the slash in front of the last name; for a name in the root that leaves nothing
+    info->parent.start = path;
+    if (last != NULL) {
+        const char *parent_end = last;
+        while (parent_end > path && parent_end[-1] == '/') {
+            parent_end--;
+        }
+        info->parent.length = (int) (parent_end - path);
+        info->last.start = last;
+        info->last.length = (int) (last_end - last);
+    } else {
+        // the empty view still points at something, so it can be compared and copied like any other
+        info->last.start = p;
+    }
+}
+
+
+/*
+ * The stripe the write buffer of the file in slot is kept in. Slots of one directory block are neighbours, so they
+ * are spread over the stripes by a multiplicative hash.
+ */
+static struct buffer_stripe *buffer_stripe(long slot) {
+    return &get_instance()->buffer_stripes[((uint64_t) slot * 0x9E3779B97F4A7C15ULL) >> 58];
+}
+
+
+/*
+ * The write buffer of the file in slot, NULL if it has none. The directory's lock must be held, which keeps the buffer
+ * from going away.
+ */
+static struct write_buffer *find_buffer(long slot) {
+    // no file has a buffer most of the time, and then nothing is locked at all
+    if (__atomic_load_n(&get_instance()->buffer_count, __ATOMIC_ACQUIRE) == 0) {
+        return NULL;
+    }
+
+    struct buffer_stripe *stripe = buffer_stripe(slot);
+    pthread_mutex_lock(&stripe->lock);
+    struct write_buffer *pending = stripe->buffers;
+    while (pending != NULL && pending->slot != slot) {
+        pending = pending->next;
+    }
+    pthread_mutex_unlock(&stripe->lock);
+
+    return pending;
+}
+
+
+/*
+ * Puts a new write buffer in its stripe. The directory's lock must be held exclusively.
+ */
+static void add_buffer(struct write_buffer *pending) {
+    struct buffer_stripe *stripe = buffer_stripe(pending->slot);
+
+    pthread_mutex_lock(&stripe->lock);
+    pending->next = stripe->buffers;
+    stripe->buffers = pending;
+    pthread_mutex_unlock(&stripe->lock);
+
+    __atomic_add_fetch(&get_instance()->buffer_count, 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Takes the write buffer of the file in slot out of its stripe.
+ *
+ * @return the buffer, NULL if the file has none
+ */
+static struct write_buffer *unlink_buffer(long slot) {
+    struct buffer_stripe *stripe = buffer_stripe(slot);
+
+    pthread_mutex_lock(&stripe->lock);
+    struct write_buffer **link = &stripe->buffers;
+    while (*link != NULL && (*link)->slot != slot) {
+        link = &(*link)->next;
+    }
+    struct write_buffer *pending = *link;
+    if (pending != NULL) {
+        *link = pending->next;
+    }
+    pthread_mutex_unlock(&stripe->lock);
+
+    return pending;
+}
+
+
+/*
+ * Hands the blocks a write buffer had set aside back to the allocator.
+ */
+static void release_reservation(struct write_buffer *pending) {
+    if (pending->reserved > 0) {
+        unreserve_free_blocks(pending->reserved);
+        pending->reserved = 0;
+    }
+}
+
+
+void drop_buffer(long slot) {
+    if (__atomic_load_n(&get_instance()->buffer_count, __ATOMIC_ACQUIRE) == 0) {
+        return;
+    }
+
+    struct write_buffer *pending = unlink_buffer(slot);
+    if (pending != NULL) {
+        __atomic_sub_fetch(&get_instance()->buffer_count, 1, __ATOMIC_RELEASE);
+        release_reservation(pending);
+        free(pending->data);
+        free(pending);
+    }
+}
+
+
+/*
+ * Moves a write buffer along with its file's entry, which may take it to another stripe. The directory's lock must
+ * be held exclusively.
+ */
+static void move_buffer(long from, long to) {
+    if (__atomic_load_n(&get_instance()->buffer_count, __ATOMIC_ACQUIRE) == 0) {
+        return;
+    }
+
+    struct write_buffer *pending = unlink_buffer(from);
+    if (pending != NULL) {
+        pending->slot = to;
+
+        struct buffer_stripe *stripe = buffer_stripe(to);
+        pthread_mutex_lock(&stripe->lock);
+        pending->next = stripe->buffers;
+        stripe->buffers = pending;
+        pthread_mutex_unlock(&stripe->lock);
+    }
+}
+
+
+void stat_entry(cs1550_disk *disk, long dir_block, long slot, struct stat *stbuf) {
+    memset(stbuf, 0, sizeof(struct stat));
+
+    // nothing keeps when something was last read, so it goes by when it last changed
+    struct cs1550_attributes *attributes = entry_attributes(disk, dir_block, slot);
+    stbuf->st_atime = stbuf->st_mtime = (time_t) attributes->mtime;
+    stbuf->st_ctime = (time_t) attributes->ctime;
+    stbuf->st_blksize = (blksize_t) disk->block_size;    //what cp and friends size their buffers by
+
+    if (slot == -1) {
+        stbuf->st_ino = inode_number(&get_instance()->inodes, dir_block, -1);
+        stbuf->st_mode = S_IFDIR | 0755;
+        stbuf->st_nlink = 2;
+        stbuf->st_size = (off_t) disk->block_size;
+        stbuf->st_blocks = (blkcnt_t) (disk->block_size / 512);
+    } else {
+        struct cs1550_file_directory *file = slot_file(disk, slot);
+
+        // data blocks plus the blocks holding the extents, as du would want to see them
+        long blocks = 0;
+        long start, count;
+        struct extent_iterator it = {0};
+        while (next_extent(disk, file, &it, &start, &count)) {
+            blocks += count;
+        }
+        for (long b = file->nExtentBlock; b != 0; b = ((cs1550_extent_block *) block_address(disk, b))->nNext) {
+            blocks++;
+        }
+
+        // what the write buffer holds is part of the file already, as are the blocks set aside for it
+        size_t buffered = 0;
+        struct write_buffer *pending = find_buffer(slot);
+        if (pending != NULL) {
+            buffered = pending->length;
+            blocks += pending->reserved;
+        }
+
+        stbuf->st_ino = inode_number(&get_instance()->inodes, dir_block, slot);
+        //regular file, probably want to be read and write
+        stbuf->st_mode = S_IFREG | 0666;
+        stbuf->st_nlink = 1; //file links
+        stbuf->st_size = (off_t) (file->fsize + buffered); //without it the kernel never asks us to read
+        stbuf->st_blocks = (blkcnt_t) (blocks * (long) (disk->block_size / 512));
+    }
+}
+
+
+void stat_disk(cs1550_disk *disk, struct statvfs *stbuf) {
+    struct Singleton *instance = get_instance();
+
+    pthread_mutex_lock(&instance->alloc_lock);
+    long unused = instance->free_blocks;
+    long pool = (long) (disk->super->dir_pool_end - disk->super->dir_pool_next);
+    pthread_mutex_unlock(&instance->alloc_lock);
+
+    // the indexes count every directory and file they hold
+    pthread_rwlock_rdlock(&instance->directories.lock);
+    long directories = instance->directories.count;
+    pthread_rwlock_unlock(&instance->directories.lock);
+    pthread_rwlock_rdlock(&instance->files.lock);
+    long files = instance->files.count;
+    pthread_rwlock_unlock(&instance->files.lock);
+
+    memset(stbuf, 0, sizeof(struct statvfs));
+    stbuf->f_bsize = disk->block_size;
+    stbuf->f_frsize = disk->block_size;
+    stbuf->f_blocks = (fsblkcnt_t) disk->block_count;
+    // preallocated directory blocks are only free for directories
+    stbuf->f_bfree = (fsblkcnt_t) (unused + pool);
+    stbuf->f_bavail = (fsblkcnt_t) unused;
+
+    // directories grow a block at a time, so every free block could still hold a block of files
+    long slots = directories + files + (unused + pool) * (long) MAX_FILES_IN_DIR(disk);
+    stbuf->f_files = (fsfilcnt_t) slots;
+    stbuf->f_ffree = (fsfilcnt_t) (slots - directories - files);
+    stbuf->f_favail = stbuf->f_ffree;
+    stbuf->f_namemax = MAX_NAME;
+}
+
+
+/*
+ * Gives a block that held a directory or names back to the bitmap. The map lock must be held.
+ */
+static void free_directory_block(cs1550_disk *disk, long block) {
+    pthread_mutex_lock(&get_instance()->alloc_lock);
+    set_bit_map(block, 1, 0, disk->bitmap);
+    mark_dirty(disk, &disk->bitmap[block / 8], 1);
+    pthread_mutex_unlock(&get_instance()->alloc_lock);
+}
+
+
+/*
+ * Chains a new, empty block onto the end of a directory or the root. The map lock must be held.
+ *
+ * @param head first block of the directory, or the root block
+ * @return the new last block
+ *      -ENOSPC if there is no block left
+ */
+static long extend_directory(cs1550_disk *disk, long head) {
+    long block = get_directory_block(disk);
+    if (block == -1) {
+        return -ENOSPC;
+    }
+
+    long last = last_directory_block(disk, head);
+    char *fresh = block_address(disk, block);
+
+    // a block from the bitmap may still hold whatever was there before
+    memset(fresh, 0, disk->block_size);
+    DIRECTORY_CHAIN(disk, fresh)->nPrev = last;
+    DIRECTORY_CHAIN(disk, fresh)->nHead = head;
+    DIRECTORY_CHAIN(disk, block_address(disk, last))->nNext = block;
+    DIRECTORY_CHAIN(disk, block_address(disk, head))->nPrev = block;
+
+    mark_dirty(disk, fresh, disk->block_size);
+    mark_dirty(disk, block_address(disk, last), disk->block_size);
+    mark_dirty(disk, block_address(disk, head), disk->block_size);
+
+    return block;
+}
+
+/*
+ * Unchains the last block of a directory or the root and frees it, once it has been emptied. The first block always
+ * stays. The map lock must be held.
+ */
+static void shrink_directory(cs1550_disk *disk, long head) {
+    long last = last_directory_block(disk, head);
+    if (last == head) {
+        return;
+    }
+
+    long prev = DIRECTORY_CHAIN(disk, block_address(disk, last))->nPrev;
+    DIRECTORY_CHAIN(disk, block_address(disk, prev))->nNext = 0;
+    DIRECTORY_CHAIN(disk, block_address(disk, head))->nPrev = prev != head ? prev : 0;
+    mark_dirty(disk, block_address(disk, prev), disk->block_size);
+    mark_dirty(disk, block_address(disk, head), disk->block_size);
+
+    free_directory_block(disk, last);
+}
+
+
+/*
+ * Copies a name to the end of the current name block of a directory or the root, starting a new name block when it
+ * doesn't fit. A name block left behind is freed along with the last of its names; names are never moved to close
+ * the gaps the others leave, so a directory with a lot of turnover can hold on to a few blocks of dead names. The map
+ * lock must be held.
+ *
+ * @param head first block of the directory, or the root block
+ * @param location set to where the name went
+ * @return 0 on success
+ *      -ENOSPC if there is no block left
+ */
+static int add_name(cs1550_disk *disk, long head, const struct path_view *name, uint64_t *location) {
+    struct cs1550_directory_names *names = DIRECTORY_NAMES(disk, block_address(disk, head));
+    long block = names->nNameBlock;
+    struct cs1550_name_block *heap = block != 0 ? (struct cs1550_name_block *) block_address(disk, block) : NULL;
+
+    if (heap == NULL || heap->nUsed + name->length > (int) MAX_NAME_BYTES(disk)) {
+        block = get_directory_block(disk);
+        if (block == -1) {
+            return -ENOSPC;
+        }
+
+        // only the counts have to start out zero; the rest is never read before it's written
+        heap = (struct cs1550_name_block *) block_address(disk, block);
+        heap->nLive = 0;
+        heap->nUsed = 0;
+        names->nNameBlock = block;
+        mark_dirty(disk, block_address(disk, head), disk->block_size);
+    }
+
+    *location = NAME_LOCATION(block, heap->nUsed);
+    memcpy(heap->names + heap->nUsed, name->start, (size_t) name->length);
+    heap->nUsed += name->length;
+    heap->nLive += name->length;
+    mark_dirty(disk, heap, disk->block_size);
+
+    return 0;
+}
+
+/*
+ * Lets go of a name add_name() stored. Its block is freed once it holds no other name still in use, unless it's the
+ * directory's current name block, which starts over instead. The map lock must be held.
+ */
+static void drop_name(cs1550_disk *disk, long head, uint64_t location, int length) {
+    long block = NAME_BLOCK(location);
+    struct cs1550_name_block *heap = (struct cs1550_name_block *) block_address(disk, block);
+
+    heap->nLive -= length;
+    if (heap->nLive > 0) {
+        mark_dirty(disk, heap, disk->block_size);
+    } else if (block == DIRECTORY_NAMES(disk, block_address(disk, head))->nNameBlock) {
+        heap->nUsed = 0;
+        mark_dirty(disk, heap, disk->block_size);
+    } else {
+        free_directory_block(disk, block);
+    }
+}
+
+/*
+ * Names an entry about to be added to a directory other than the root, in its name block. The map lock must be held.
+ *
+ * @param dir_block first block of the directory
+ * @return 0 on success
+ *      -ENOSPC if there is no block left for the name
+ */
+static int name_entry(cs1550_disk *disk, long dir_block, struct cs1550_file_directory *file,
+                      const struct path_view *name) {
+    uint64_t location;
+    int result = add_name(disk, dir_block, name, &location);
+
+    file->nameHash = NAME_HASH(name->start, name->length);
+    file->nameLocation = location;
+    file->nameLength = (uint8_t) name->length;
+    return result;
+}
+
+/*
+ * name_entry() for a directory about to be added to the root.
+ */
+static int name_root_entry(cs1550_disk *disk, struct cs1550_directory *directory, const struct path_view *name) {
+    uint64_t location;
+    int result = add_name(disk, disk->root_block, name, &location);
+
+    directory->nameLocation = location;
+    directory->nameLength = (uint8_t) name->length;
+    return result;
+}
+
+
+/*
+ * Whether touch_entry() would change anything, i.e. the entry wasn't stamped yet this second. The map lock must be
+ * held.
+ */
+static int entry_stale(cs1550_disk *disk, long dir_block, long slot) {
+    const struct cs1550_attributes *attributes = entry_attributes(disk, dir_block, slot);
+    int64_t now = (int64_t) time(NULL);
+
+    return attributes->mtime != now || attributes->ctime != now;
+}
+
+
+/*
+ * Stamps the contents of a directory or file as changed now; only the first change in a second dirties its block.
+ * The map lock must be held, and the directory's lock exclusively.
+ *
+ * @param slot slot of the file, -1 for the directory dir_block itself (0 for the root)
+ */
+static void touch_entry(cs1550_disk *disk, long dir_block, long slot) {
+    if (entry_stale(disk, dir_block, slot)) {
+        struct cs1550_attributes *attributes = entry_attributes(disk, dir_block, slot);
+        attributes->mtime = attributes->ctime = (int64_t) time(NULL);
+        mark_dirty(disk, attributes, sizeof(struct cs1550_attributes));
+    }
+}
+
+
+/*
+ * Gives a directory or file that was just made the next inode number, and keeps it on the image along with the
+ * time. The map lock must be held.
+ *
+ * @param parent first block of the directory it was made in, 0 for the root
+ */
+static void number_entry(cs1550_disk *disk, long dir_block, long slot, long parent) {
+    struct Singleton *instance = get_instance();
+    struct cs1550_attributes *attributes = entry_attributes(disk, dir_block, slot);
+    ino_t ino = inode_next(&instance->inodes);
+
+    inode_insert(&instance->inodes, ino, dir_block, slot, parent);
+    attributes->nInode = (uint64_t) ino;
+    attributes->mtime = attributes->ctime = (int64_t) time(NULL);
+    mark_dirty(disk, attributes, sizeof(struct cs1550_attributes));
+}
+
+
+/*
+ * Finds room for one more entry at the end of a directory other than the root, chaining on a block if its last one
+ * is full. The map lock must be held.
+ *
+ * @return the block the entry goes in
+ *      -ENOSPC if there is no block left
+ */
+static long directory_tail(cs1550_disk *disk, long dir_block) {
+    long block = last_directory_block(disk, dir_block);
+    cs1550_directory_entry *entry = (cs1550_directory_entry *) block_address(disk, block);
+
+    return entry->nFiles < (int) MAX_FILES_IN_DIR(disk) ? block : extend_directory(disk, dir_block);
+}
+
+
+int create_directory(cs1550_disk *disk, long parent, const struct path_view *dir_name, long *dir_block) {
+    struct Singleton *instance = get_instance();
+    int result = check_name(dir_name);
+
+    if (result != 0) {
+        // the name is too long
+    } else if (parent == 0 ? find_directory(disk, 0, dir_name) != -1 : find_entry(disk, parent, dir_name) != -1) {
+        // if the name is taken
+        result = -EEXIST;
+    }
+
+    pthread_rwlock_rdlock(&instance->map_lock);
+
+    // new directories go at the end of the one holding them, which grows a block when its last one is full
+    struct cs1550_root_directory *bitmapFileHeader = NULL;
+    cs1550_directory_entry *entry = NULL;
+    long tail = 0;
+    if (result == 0 && parent == 0) {
+        tail = last_directory_block(disk, disk->root_block);
+        bitmapFileHeader = (struct cs1550_root_directory *) block_address(disk, tail);
+        if (bitmapFileHeader->nDirectories == (int) MAX_DIRS_IN_ROOT(disk)) {
+            tail = extend_directory(disk, disk->root_block);
+        }
+    } else if (result == 0) {
+        tail = directory_tail(disk, parent);
+    }
+    if (tail < 0) {
+        result = (int) tail;
+    } else if (result == 0 && parent == 0) {
+        bitmapFileHeader = (struct cs1550_root_directory *) block_address(disk, tail);
+    } else if (result == 0) {
+        entry = (cs1550_directory_entry *) block_address(disk, tail);
+    }
+
+    // the name goes into the free slot past the last entry before anything counts it
+    struct cs1550_directory *directory = NULL;
+    struct cs1550_file_directory *file = NULL;
+    if (result == 0 && parent == 0) {
+        directory = &bitmapFileHeader->directories[bitmapFileHeader->nDirectories];
+        memset(directory, 0, sizeof(struct cs1550_directory));
+        result = name_root_entry(disk, directory, dir_name);
+    } else if (result == 0) {
+        file = &entry->files[entry->nFiles];
+        memset(file, 0, sizeof(struct cs1550_file_directory));
+        result = name_entry(disk, parent, file, dir_name);
+    }
+
+    long start_block = -1;
+    if (result == 0) {
+        start_block = get_directory_block(disk);
+        if (start_block == -1) {
+            result = -ENOSPC;
+            drop_name(disk, parent == 0 ? disk->root_block : parent,
+                      parent == 0 ? directory->nameLocation : file->nameLocation,
+                      parent == 0 ? directory->nameLength : file->nameLength);
+        }
+    }
+    if (result != 0 && tail > 0 && (parent == 0 ? bitmapFileHeader->nDirectories == 0 : entry->nFiles == 0)) {
+        // don't leave an empty block at the end
+        shrink_directory(disk, parent == 0 ? disk->root_block : parent);
+    }
+
+    // else create directory
+    if (result == 0) {
+        assert(start_block < disk->block_count);
+
+        // a block from the bitmap may still hold whatever was there before, chain included
+        cs1550_directory_entry *new_entry = (cs1550_directory_entry *) block_address(disk, start_block);
+        memset(new_entry, 0, disk->block_size);
+
+        if (parent == 0) {
+            // we are adding a new directory therefor we can write directly to the end
+            directory->nStartBlock = start_block;
+
+            bitmapFileHeader->nDirectories++;
+            mark_dirty(disk, bitmapFileHeader, disk->block_size);
+        } else {
+            int m = entry->nFiles;
+            entry->nFiles++;
+
+            file->fsize = SUBDIRECTORY_SIZE;
+            file->nStartBlock = start_block;
+
+            index_insert(&instance->files, parent, dir_name, file->nameHash, make_slot(tail, m));
+            mark_dirty(disk, entry, disk->block_size);
+        }
+
+        index_insert(&instance->directories, parent, dir_name, NAME_HASH(dir_name->start, dir_name->length),
+                     start_block);
+        number_entry(disk, start_block, -1, parent);
+        touch_entry(disk, parent, -1);
+        mark_dirty(disk, new_entry, disk->block_size);
+    }
+
+    pthread_rwlock_unlock(&instance->map_lock);
+
+    if (result == 0) {
+        finish_operation(disk);
+        *dir_block = start_block;
+    }
+
+    return result;
+}
+
+
+int create_file(cs1550_disk *disk, long dir_block, const struct path_view *name, long *slot) {
+    int result = check_name(name);
+
+    if (result == 0 && find_entry(disk, dir_block, name) != -1) {
+        // a subdirectory takes its name as much as a file does
+        result = -EEXIST;
+    }
+
+    // create file;
+    if (result == 0) {
+        pthread_rwlock_rdlock(&get_instance()->map_lock);
+
+        // new files go at the end of the directory, which grows a block when its last one is full
+        long block = directory_tail(disk, dir_block);
+        if (block < 0) {
+            result = (int) block;
+        }
+
+        cs1550_directory_entry *entry = NULL;
+        if (result == 0) {
+            entry = (cs1550_directory_entry *) block_address(disk, block);
+
+            // blocks are handed out by the first write that needs them, so only the name has to be filled in
+            memset(&entry->files[entry->nFiles], 0, sizeof(struct cs1550_file_directory));
+            result = name_entry(disk, dir_block, &entry->files[entry->nFiles], name);
+            if (result != 0 && entry->nFiles == 0) {
+                shrink_directory(disk, dir_block);
+            }
+        }
+
+        if (result == 0) {
+            print_debug(("Creating file entry %.*s\n", name->length, name->start));
+            // m is the next free position in the directory structure for me to store the file
+            int m = entry->nFiles;
+            entry->nFiles++;
+
+            *slot = make_slot(block, m);
+            index_insert(&get_instance()->files, dir_block, name, entry->files[m].nameHash, *slot);
+            number_entry(disk, dir_block, *slot, dir_block);
+            touch_entry(disk, dir_block, -1);
+
+            mark_dirty(disk, entry, disk->block_size);
+        }
+
+        pthread_rwlock_unlock(&get_instance()->map_lock);
+
+        if (result == 0) {
+            finish_operation(disk);
+        }
+    }
+
+    return result;
+}
+
+
+int read_file(cs1550_disk *disk, long slot, char *buf, size_t size, off_t offset, struct extent_cursor *cursor) {
+    struct cs1550_file_directory *file = slot_file(disk, slot);
+
+    print_debug(("Reading file in slot %lx\n", slot));
+
+    // only what the kernel asked for, and never past the end of the file, which may lie in its write buffer
+    size_t fsize = file->fsize;
+    struct write_buffer *pending = find_buffer(slot);
+    size_t end = fsize + (pending != NULL ? pending->length : 0);
+    if (offset >= (off_t) end) {
+        size = 0;
+    } else if (offset + size > end) {
+        size = end - offset;
+    }
+
+    // the file lives in the mapping, so reading it is just a copy out of memory
+    size_t stored = offset >= (off_t) fsize ? 0 : offset + size > fsize ? fsize - offset : size;
+    file_io(disk, file, buf, stored, offset, false, cursor);
+    if (stored < size) {
+        memcpy(buf + stored, pending->data + (offset + stored - fsize), size - stored);
+    }
+    print_debug(("size = %d\n", (int) size));
+
+    return (int) size;
+}
+
+
+int write_grows_file(cs1550_disk *disk, long slot, size_t size, off_t offset) {
+    return offset + size > slot_file(disk, slot)->fsize;
+}
+
+
+int flush_buffer(cs1550_disk *disk, long slot) {
+    cs1550_directory_entry *entry = (cs1550_directory_entry *) block_address(disk, slot_block(slot));
+    struct cs1550_file_directory *file = &entry->files[slot_index(slot)];
+    struct write_buffer *pending = find_buffer(slot);
+
+    if (pending == NULL) {
+        return 0;
+    }
+
+    print_debug(("Flushing %ld buffered bytes of the file in slot %lx\n", (long) pending->length, slot));
+
+    // the blocks set aside for the buffer go back just before grow_file() takes them
+    release_reservation(pending);
+
+    pthread_rwlock_rdlock(&get_instance()->map_lock);
+
+    // one grow for the whole buffer, so its blocks come in as few extents as the bitmap allows
+    off_t offset = (off_t) file->fsize;
+    int result = grow_file(disk, entry, file, file->fsize + pending->length);
+    if (result == 0) {
+        file_io(disk, file, pending->data, pending->length, offset, true, NULL);
+    }
+
+    pthread_rwlock_unlock(&get_instance()->map_lock);
+
+    int written = finish_operation(disk);
+
+    if (result != 0) {
+        // the writes in it were acknowledged, so it stays for the next flush, with as much set aside again as is
+        // left; grow_file() may have added some of the blocks before it gave up
+        long have = 0;
+        long start, count;
+        struct extent_iterator it = {0};
+        while (next_extent(disk, file, &it, &start, &count)) {
+            have += count;
+        }
+        pending->blocks = have;
+
+        long need = (long) ((file->fsize + pending->length + disk->block_size - 1) / disk->block_size) - have;
+        pending->reserved = reserve_free_blocks(need, true);
+
+        return result;
+    }
+
+    drop_buffer(slot);
+
+    return written < 0 ? written : 0;
+}
+
+
+/*
+ * Gathers a write that grows a file in the file's write buffer. The directory's lock must be held exclusively.
+ *
+ * Only a write that starts inside the buffer, or right where it ends, and that still fits is taken. Anything else
+ * flushes the buffer first and is left to the caller, apart from a write that only overflowed a full buffer, which
+ * starts a new one.
+ *
+ * @return size if the write was buffered
+ *      0 if it wasn't, with the buffer flushed
+ *      -ENOSPC if the disk doesn't have the blocks the buffer will need
+ *      -ENOMEM if the buffer can't grow
+ *      otherwise what flush_buffer() returned
+ */
+static int buffer_write(cs1550_disk *disk, long slot, const char *buf, size_t size, off_t offset) {
+    struct Singleton *instance = get_instance();
+    struct cs1550_file_directory *file = slot_file(disk, slot);
+    struct write_buffer *pending = find_buffer(slot);
+    size_t length = pending != NULL ? pending->length : 0;
+
+    if (offset < (off_t) file->fsize || (size_t) offset > file->fsize + length ||
+        (size_t) offset + size - file->fsize > instance->write_buffer_max) {
+        int result = flush_buffer(disk, slot);
+        if (result != 0 || pending == NULL) {
+            return result;
+        }
+        return buffer_write(disk, slot, buf, size, offset);
+    }
+
+    size_t end = (size_t) offset + size - file->fsize;    //bytes past the file's size once this is in
+    if (end < length) {
+        end = length;
+    }
+
+    int fresh = pending == NULL;
+    if (fresh) {
+        pending = calloc(1, sizeof(struct write_buffer));
+        if (pending == NULL) {
+            return -ENOMEM;
+        }
+        pending->slot = slot;
+
+        long start, count;
+        struct extent_iterator it = {0};
+        while (next_extent(disk, file, &it, &start, &count)) {
+            pending->blocks += count;
+        }
+    }
+
+    int result = (int) size;
+
+    if (end > pending->capacity) {
+        size_t capacity = pending->capacity == 0 ? WRITE_BUFFER_MIN : pending->capacity;
+        while (capacity < end) {
+            capacity *= 2;
+        }
+        if (capacity > instance->write_buffer_max) {
+            capacity = instance->write_buffer_max;
+        }
+
+        char *data = realloc(pending->data, capacity);
+        if (data != NULL) {
+            pending->data = data;
+            pending->capacity = capacity;
+        } else {
+            result = -ENOMEM;
+        }
+    }
+
+    // everything the buffer will need is set aside now; the flush hands it back just before it allocates
+    long need = (long) ((file->fsize + end + disk->block_size - 1) / disk->block_size) - pending->blocks;
+    if (result > 0 && need > pending->reserved) {
+        if (reserve_free_blocks(need - pending->reserved, false) == 0) {
+            result = -ENOSPC;
+        } else {
+            pending->reserved = need;
+        }
+    }
+
+    if (result > 0) {
+        memcpy(pending->data + (offset - (off_t) file->fsize), buf, size);
+        pending->length = end;
+
+        if (fresh) {
+            add_buffer(pending);
+        }
+    } else if (fresh) {
+        free(pending->data);
+        free(pending);
+    }
+
+    return result;
+}
+
+
+int write_file(cs1550_disk *disk, long slot, const char *buf, size_t size, off_t offset,
+               struct extent_cursor *cursor) {
+    // entry is the directory block holding the file, which needn't be the directory's first
+    cs1550_directory_entry *entry = (cs1550_directory_entry *) block_address(disk, slot_block(slot));
+    struct cs1550_file_directory *file = &entry->files[slot_index(slot)];
+    int result = 0;
+
+    print_debug(("Writing to file in slot %lx\n", slot));
+
+    // a write that grows the file gets its blocks when the write buffer is flushed
+    if (get_instance()->write_buffer_max > 0 && size > 0 && write_grows_file(disk, slot, size, offset)) {
+        result = buffer_write(disk, slot, buf, size, offset);
+        if (result != 0) {
+            return result;
+        }
+    }
+
+    pthread_rwlock_rdlock(&get_instance()->map_lock);
+
+    // writing past the end grows the file; its extents are extended as needed
+    if (write_grows_file(disk, slot, size, offset)) {
+        result = grow_file(disk, entry, file, offset + size);
+    }
+
+    if (result == 0) {
+        // store into the mapping and write back only the blocks the data landed in
+        file_io(disk, file, (char *) buf, size, offset, true, cursor);
+    }
+
+    pthread_rwlock_unlock(&get_instance()->map_lock);
+
+    // on failure this keeps whatever was allocated before running out of room consistent on disk
+    int written = finish_operation(disk);
+
+    if (result == 0 && written >= 0) {
+        result = (int) size;
+        print_debug(("size = %d\n", result));
+    } else if (result == 0) {
+        result = written;
+    }
+
+    return result;
+}
+
+
+int truncate_file(cs1550_disk *disk, long dir_block, long slot, off_t size) {
+    cs1550_directory_entry *entry = (cs1550_directory_entry *) block_address(disk, slot_block(slot));
+    struct cs1550_file_directory *file = &entry->files[slot_index(slot)];
+    int result = 0;
+
+    print_debug(("Truncating file in slot %lx to %ld\n", slot, (long) size));
+
+    // what the write buffer holds starts at the old size, so it's only kept if the file still reaches past that
+    if ((size_t) size <= file->fsize) {
+        drop_buffer(slot);
+    } else {
+        result = flush_buffer(disk, slot);
+        if (result != 0) {
+            return result;
+        }
+    }
+
+    pthread_rwlock_rdlock(&get_instance()->map_lock);
+
+    if ((size_t) size > file->fsize) {
+        result = grow_file(disk, entry, file, (size_t) size);
+    } else if ((size_t) size < file->fsize) {
+        shrink_file(disk, entry, file, (size_t) size);
+        get_instance()->generations[dir_block % DIRECTORY_LOCKS]++;    //extents handles point into may be gone
+    }
+    if (result == 0) {
+        touch_entry(disk, dir_block, slot);
+    }
+
+    pthread_rwlock_unlock(&get_instance()->map_lock);
+
+    finish_operation(disk);
+
+    return result;
+}
+
+
+void set_mtime(cs1550_disk *disk, long dir_block, long slot, time_t mtime) {
+    pthread_rwlock_rdlock(&get_instance()->map_lock);
+
+    struct cs1550_attributes *attributes = entry_attributes(disk, dir_block, slot);
+    attributes->mtime = (int64_t) mtime;
+    attributes->ctime = (int64_t) time(NULL);
+    mark_dirty(disk, attributes, sizeof(struct cs1550_attributes));
+
+    pthread_rwlock_unlock(&get_instance()->map_lock);
+
+    finish_operation(disk);
+}
+
+
+/*
+ * Takes the entry in slot out of a directory other than the root and out of the file index. The directory's last
+ * entry moves into the hole, attributes and all, and its last block is unchained once that empties it. The map lock
+ * must be held.
+ */
+static void remove_entry(cs1550_disk *disk, long dir_block, long slot) {
+    struct Singleton *instance = get_instance();
+    cs1550_directory_entry *entry = (cs1550_directory_entry *) block_address(disk, slot_block(slot));
+    struct cs1550_file_directory *file = &entry->files[slot_index(slot)];
+
+    // the last entry of the directory is the one that fills the hole
+    long last_block = last_directory_block(disk, dir_block);
+    cs1550_directory_entry *last_entry = (cs1550_directory_entry *) block_address(disk, last_block);
+    long last = make_slot(last_block, last_entry->nFiles - 1);
+    char buf[MAX_NAME + 1];
+
+    struct path_view name = {buf, entry_name(disk, file, buf)};
+    index_remove(&instance->files, dir_block, &name);
+    drop_name(disk, dir_block, file->nameLocation, file->nameLength);
+    drop_buffer(slot);
+    inode_remove(&instance->inodes, dir_block, slot);
+
+    if (slot != last) {
+        // its name stays where it is; only the entry moves
+        struct cs1550_file_directory *moved = slot_file(disk, last);
+        name.length = entry_name(disk, moved, buf);
+        index_remove(&instance->files, dir_block, &name);
+
+        *file = *moved;
+        *entry_attributes(disk, dir_block, slot) = *entry_attributes(disk, dir_block, last);
+        index_insert(&instance->files, dir_block, &name, file->nameHash, slot);
+        move_buffer(last, slot);
+        inode_move(&instance->inodes, last, slot);
+        mark_dirty(disk, entry, disk->block_size);
+    }
+
+    memset(slot_file(disk, last), 0, sizeof(struct cs1550_file_directory));
+    memset(entry_attributes(disk, dir_block, last), 0, sizeof(struct cs1550_attributes));
+    last_entry->nFiles--;
+    mark_dirty(disk, last_entry, disk->block_size);
+    touch_entry(disk, dir_block, -1);
+
+    if (last_entry->nFiles == 0) {
+        shrink_directory(disk, dir_block);
+    }
+}
+
+
+void remove_file(cs1550_disk *disk, long dir_block, long slot) {
+    struct Singleton *instance = get_instance();
+    cs1550_directory_entry *entry = (cs1550_directory_entry *) block_address(disk, slot_block(slot));
+    struct cs1550_file_directory *file = &entry->files[slot_index(slot)];
+
+    print_debug(("Removing file in slot %lx\n", slot));
+
+    pthread_rwlock_rdlock(&instance->map_lock);
+
+    shrink_file(disk, entry, file, 0);
+    remove_entry(disk, dir_block, slot);
+
+    pthread_rwlock_unlock(&instance->map_lock);
+
+    instance->generations[dir_block % DIRECTORY_LOCKS]++;
+
+    finish_operation(disk);
+}
+
+
+int remove_directory(cs1550_disk *disk, long parent, const struct path_view *dir_name) {
+    struct Singleton *instance = get_instance();
+
+    long dir_block = find_directory(disk, parent, dir_name);
+    if (dir_block == -1) {
+        return parent != 0 && find_entry(disk, parent, dir_name) != -1 ? -ENOTDIR : -ENOENT;
+    }
+
+    // the blocks are packed, so a directory with anything in it has some in its first block
+    cs1550_directory_entry *entry = (cs1550_directory_entry *) block_address(disk, dir_block);
+    if (entry->nFiles > 0) {
+        return -ENOTEMPTY;
+    }
+
+    print_debug(("Removing directory %.*s\n", dir_name->length, dir_name->start));
+
+    pthread_rwlock_rdlock(&instance->map_lock);
+
+    index_remove(&instance->directories, parent, dir_name);
+
+    if (parent != 0) {
+        remove_entry(disk, parent, find_entry(disk, parent, dir_name));
+    } else {
+        long root_block = disk->root_block;
+        struct cs1550_root_directory *root;
+        int i;
+        for (;;) {
+            root = (struct cs1550_root_directory *) block_address(disk, root_block);
+            for (i = 0; i < root->nDirectories && root->directories[i].nStartBlock != dir_block; ++i);
+            if (i < root->nDirectories) {
+                break;
+            }
+            root_block = next_directory_block(disk, root_block);
+        }
+
+        // the last directory of the root is the one that fills the hole
+        struct cs1550_root_directory *last_root =
+                (struct cs1550_root_directory *) block_address(disk, last_directory_block(disk, disk->root_block));
+        int last = last_root->nDirectories - 1;
+
+        drop_name(disk, disk->root_block, root->directories[i].nameLocation, root->directories[i].nameLength);
+        root->directories[i] = last_root->directories[last];
+        memset(&last_root->directories[last], 0, sizeof(struct cs1550_directory));
+        last_root->nDirectories--;
+        mark_dirty(disk, root, disk->block_size);
+        mark_dirty(disk, last_root, disk->block_size);
+
+        if (last_root->nDirectories == 0) {
+            shrink_directory(disk, disk->root_block);
+        }
+        touch_entry(disk, 0, -1);
+    }
+
+    // every name it had is gone, so all that can be left of them is its current name block, started over
+    if (DIRECTORY_NAMES(disk, entry)->nNameBlock != 0) {
+        free_directory_block(disk, DIRECTORY_NAMES(disk, entry)->nNameBlock);
+    }
+    free_directory_block(disk, dir_block);
+
+    pthread_rwlock_unlock(&instance->map_lock);
+
+    inode_remove(&instance->inodes, dir_block, -1);
+    instance->generations[dir_block % DIRECTORY_LOCKS]++;
+    instance->generations[parent % DIRECTORY_LOCKS]++;
+
+    finish_operation(disk);
+
+    return 0;
+}
+
+
+struct open_file *open_handle(long dir_block, long slot) {
+    struct open_file *handle = calloc(1, sizeof(struct open_file));
+
+    if (handle != NULL) {
+        pthread_mutex_init(&handle->lock, NULL);
+        handle->dir_block = dir_block;
+        handle->ino = inode_number(&get_instance()->inodes, dir_block, slot);
+        handle->slot = slot;
+        handle->generation = get_instance()->generations[dir_block % DIRECTORY_LOCKS];
+    }
+
+    return handle;
+}
+
+
+void close_handle(struct open_file *handle) {
+    pthread_mutex_destroy(&handle->lock);
+    free(handle);
+}
+
+
+/*
+ * Hands out the handle's slot and cursor, finding the file again by its inode number first if its directory has moved
+ * on. The directory's lock must be held, shared being enough.
+ *
+ * @return 0 on success
+ *      -ENOENT if the file is gone; the handle stays dead from then on
+ */
+static int handle_slot(struct open_file *handle, long *slot, struct extent_cursor *cursor) {
+    unsigned long generation = get_instance()->generations[handle->dir_block % DIRECTORY_LOCKS];
+
+    pthread_mutex_lock(&handle->lock);
+
+    if (handle->slot != -1 && handle->generation != generation) {
+        long dir_block;
+
+        if (inode_place(&get_instance()->inodes, handle->ino, &dir_block, &handle->slot) != 0) {
+            handle->slot = -1;
+        }
+        handle->generation = generation;
+        memset(&handle->cursor, 0, sizeof(struct extent_cursor));
+    }
+
+    *slot = handle->slot;
+    *cursor = handle->cursor;
+
+    pthread_mutex_unlock(&handle->lock);
+
+    return *slot == -1 ? -ENOENT : 0;
+}
+
+
+/*
+ * Keeps where the last copy through the handle ended up in the extents. The directory's lock must still be held.
+ */
+static void handle_cursor(struct open_file *handle, const struct extent_cursor *cursor) {
+    pthread_mutex_lock(&handle->lock);
+    handle->cursor = *cursor;
+    pthread_mutex_unlock(&handle->lock);
+}
+
+
+/*
+ * Follows the stream of reads through a handle, and queues the next window for the readahead thread once the stream
+ * gets within half a window of what has been read ahead. Reads may arrive a little out of order when several threads
+ * serve them, so one that lands within READAHEAD_MIN of where the last ended still counts as sequential.
+ *
+ * @param slot the handle's slot, as the read found it
+ * @param offset where the read started
+ * @param size how many bytes it read
+ */
+static void handle_readahead(struct open_file *handle, long slot, off_t offset, size_t size) {
+    struct Singleton *instance = get_instance();
+    struct readahead_request request = {0};
+    off_t end = offset + (off_t) size;
+
+    pthread_mutex_lock(&handle->lock);
+
+    if (offset < handle->next_read - READAHEAD_MIN || offset > handle->next_read + READAHEAD_MIN) {
+        handle->window = 0;
+        handle->ahead = end;
+    } else if (end + (off_t) (handle->window / 2) >= handle->ahead) {
+        size_t window = handle->window == 0 ? READAHEAD_MIN : handle->window * 2;
+        handle->window = window < instance->readahead_max ? window : instance->readahead_max;
+
+        request.dir_block = handle->dir_block;
+        request.slot = slot;
+        request.generation = handle->generation;
+        request.offset = handle->ahead > end ? handle->ahead : end;
+        request.length = handle->window;
+        handle->ahead = request.offset + (off_t) request.length;
+    }
+
+    if (end > handle->next_read || handle->window == 0) {
+        handle->next_read = end;
+    }
+
+    pthread_mutex_unlock(&handle->lock);
+
+    if (request.length > 0) {
+        pthread_mutex_lock(&instance->readahead_lock);
+        if (instance->readahead_count < READAHEAD_QUEUE) {
+            instance->readahead_queue[(instance->readahead_head + instance->readahead_count) % READAHEAD_QUEUE] =
+                    request;
+            instance->readahead_count++;
+            pthread_cond_signal(&instance->readahead_wake);
+        } else {
+            instance->readahead_dropped++;
+        }
+        pthread_mutex_unlock(&instance->readahead_lock);
+    }
+}
+
+
+int read_handle(cs1550_disk *disk, struct open_file *handle, char *buf, size_t size, off_t offset) {
+    struct extent_cursor cursor;
+    long slot;
+
+    lock_namespace(false);
+    lock_directory(handle->dir_block, false);
+
+    int result = handle_slot(handle, &slot, &cursor);
+    if (result == 0) {
+        result = read_file(disk, slot, buf, size, offset, &cursor);
+        handle_cursor(handle, &cursor);
+    }
+
+    unlock_directory(handle->dir_block);
+    unlock_namespace();
+
+    // a short read hit the end of the file, so there is nothing ahead of it
+    if (result == (int) size && size > 0 && get_instance()->readahead_max > 0) {
+        handle_readahead(handle, slot, offset, (size_t) result);
+    }
+
+    return result;
+}
+
+
+int write_handle(cs1550_disk *disk, struct open_file *handle, const char *buf, size_t size, off_t offset) {
+    struct extent_cursor cursor;
+    long slot;
+    int exclusive = false;
+
+    lock_namespace(false);
+
+    // writes inside the file share the directory; one that grows the file needs it to itself, and the slot is checked
+    // again since the directory may have changed while nothing was held
+    lock_directory(handle->dir_block, false);
+    int result = handle_slot(handle, &slot, &cursor);
+    if (result == 0 && write_grows_file(disk, slot, size, offset)) {
+        unlock_directory(handle->dir_block);
+        lock_directory(handle->dir_block, true);
+        exclusive = true;
+        result = handle_slot(handle, &slot, &cursor);
+    }
+
+    if (result == 0) {
+        result = write_file(disk, slot, buf, size, offset, &cursor);
+        handle_cursor(handle, &cursor);
+    }
+
+    // the file's times share a block with the other entries, so they are only stamped with the directory held
+    // exclusively; a write inside the file takes it over just for the first write of a second
+    if (result > 0) {
+        pthread_rwlock_rdlock(&get_instance()->map_lock);
+        int stale = entry_stale(disk, handle->dir_block, slot);
+        pthread_rwlock_unlock(&get_instance()->map_lock);
+
+        if (stale && !exclusive) {
+            unlock_directory(handle->dir_block);
+            lock_directory(handle->dir_block, true);
+            stale = handle_slot(handle, &slot, &cursor) == 0;
+        }
+        if (stale) {
+            pthread_rwlock_rdlock(&get_instance()->map_lock);
+            touch_entry(disk, handle->dir_block, slot);
+            pthread_rwlock_unlock(&get_instance()->map_lock);
+            finish_operation(disk);
+        }
+    }
+
+    unlock_directory(handle->dir_block);
+    unlock_namespace();
+
+    return result;
+}
+
+
+int flush_handle(cs1550_disk *disk, struct open_file *handle) {
+    struct Singleton *instance = get_instance();
+    struct extent_cursor cursor;
+    long slot;
+
+    // every close flushes, so don't take the directory away from everyone else when nothing is buffered anywhere
+    if (__atomic_load_n(&instance->buffer_count, __ATOMIC_ACQUIRE) == 0) {
+        return 0;
+    }
+
+    lock_namespace(false);
+    lock_directory(handle->dir_block, true);
+
+    int result = handle_slot(handle, &slot, &cursor);
+    if (result == 0) {
+        result = flush_buffer(disk, slot);
+    }
+
+    unlock_directory(handle->dir_block);
+    unlock_namespace();
+
+    // a removed file took its buffer with it
+    return result == -ENOENT ? 0 : result;
+}
+
+
+#ifndef CS1550_LOWLEVEL
+/*
+ * The path based front end: libfuse hands every request over as a full path, which is parsed and looked up again.
+ * Built unless CS1550_LOWLEVEL is defined.
+ */
+
+/*
+ * Looks up the last name of a path for the operations that want a file, once its parent has been resolved. The
+ * directory's lock must be held.
+ *
+ * @param dir_block block of the parent, 0 for the root
+ * @return the slot of the file
+ *      -ENOENT if there is no such name
+ *      -EISDIR if the name is a directory
+ */
+static long lookup_file(cs1550_disk *disk, long dir_block, const struct path_info *info) {
+    if (dir_block == 0) {
+        // the root holds directories only
+        return find_directory(disk, 0, &info->last) != -1 ? -EISDIR : -ENOENT;
+    }
+
+    long slot = find_entry(disk, dir_block, &info->last);
+    if (slot == -1) {
+        return -ENOENT;
+    }
+
+    return IS_SUBDIRECTORY(slot_file(disk, slot)) ? -EISDIR : slot;
+}
+
+/*
+ * Called whenever the system wants to know the file attributes, including
+ * simply whether the file exists or not.
+ *
+ * man -s 2 stat will show the fields of a stat structure
+ *
+ * @return: 0 on success, with a correctly set structure
+ *      -ENOENT if the file is not found
+ */
+static int cs1550_getattr(const char *path, struct stat *stbuf) {
+    print_debug(("Inside cs1550_getattr = %s\n", path));
+
+    //default return that path doesn't exist
+    int result = -ENOENT;
+
+    struct path_info info;
+    parse_path(path, &info);
+
+    print_debug(("parent: %.*s\n", info.parent.length, info.parent.start));
+    print_debug(("name: %.*s\n", info.last.length, info.last.start));
+
+    cs1550_disk *disk = get_instance()->d;
+
+    lock_namespace(false);
+
+    //is path the root dir?
+    if (info.components == 0) {
+        print_debug(("In getattr for root\n"));
+
+        stat_entry(disk, 0, -1, stbuf);
+        result = 0;
+    } else {
+        long parent = resolve_directory(disk, &info.parent);
+
+        //Check if name is subdirectory
+        long dir_block = parent != -1 ? find_directory(disk, parent, &info.last) : -1;
+        if (dir_block != -1) {
+            print_debug(("In getattr for dir\n"));
+            stat_entry(disk, dir_block, -1, stbuf);
+            result = 0; //no error
+        } else if (parent > 0) { // reading file; the root holds no files
+            print_debug(("In getattr for file\n"));
+            lock_directory(parent, false);
+
+            long m = find_file(disk, parent, &info.last);
+            if (m != -1) {
+                stat_entry(disk, parent, m, stbuf);
+                result = 0; // no error
+            }
+
+            unlock_directory(parent);
+        }
+    }
+
+    unlock_namespace();
+
+    return result;
+}
+
+
+/*
+ * Called whenever the contents of a directory are desired. Could be from an 'ls'
+ * or could even be when a user hits TAB to do autocompletion
+ *
+ * This function should look up the input path, ensuring that it is a directory, and then list the contents.
+ *
+ * To list the contents, you need to use the filler() function.  For example: filler(buf, ".", NULL, 0); adds the
+ * current directory to the listing generated by ls -a
+ *
+ * In general, you will only need to change the second parameter to be the name of the file or directory you want to add
+ * to the listing.
+ *
+ * @return: 0 on success
+ *      -ENOENT if the directory is not valid or found
+ */
+static int cs1550_readdir(const char *path,
+                          void *buf,
+                          fuse_fill_dir_t filler,
+                          off_t offset,
+                          struct fuse_file_info *fi) {
+
+    print_debug(("Inside read directory path = %s\n", path));
+
+    // list the contents of the directory at path
+    // that means I need to navigate to the path first
+
+    //Since we're building with -Wall (all warnings reported) we need
+    //to "use" every parameter, so let's just cast them to void to
+    //satisfy the compiler
+
+    (void) offset;
+    (void) fi;
+
+    cs1550_disk *disk = get_instance()->d;
+
+    // this will contain all of the information about the disk
+
+    filler(buf, ".", NULL, 0);
+    filler(buf, "..", NULL, 0);
+
+    lock_namespace(false);
+
+    struct path_view dir_path = {path, (int) strlen(path)};
+    long dir_block = resolve_directory(disk, &dir_path);
+
+    char name[MAX_NAME + 1];
+
+    if (dir_block == 0) {
+        long block;
+        for (block = disk->root_block; block != 0; block = next_directory_block(disk, block)) {
+            struct cs1550_root_directory *bitmapFileHeader = (struct cs1550_root_directory *) block_address(disk, block);
+            int i;
+            for (i = 0; i < bitmapFileHeader->nDirectories; ++i) {
+                root_name(disk, &bitmapFileHeader->directories[i], name);
+                filler(buf, name, NULL, 0);
+            }
+        }
+    } else if (dir_block != -1) {
+        print_debug(("I'm in this directory %s\n", path));
+        lock_directory(dir_block, false);
+
+        // every block of the chain holds some of the cs1550_directory_entry
+        long block;
+        for (block = dir_block; block != 0; block = next_directory_block(disk, block)) {
+            cs1550_directory_entry *entry = (cs1550_directory_entry *) block_address(disk, block);
+            print_debug(("Number of entries in block %ld %d\n", block, entry->nFiles));
+
+            int j;
+            for (j = 0; j < entry->nFiles; ++j) {
+                entry_name(disk, &entry->files[j], name);
+
+                // files and subdirectories alike
+                filler(buf, name, NULL, 0);
+            }
+        }
+
+        unlock_directory(dir_block);
+    }
+
+    unlock_namespace();
+
+    return 0;
+}
+
+/**
+ * Creates a directory. We can ignore mode since we're not dealing with
+ * permissions, as long as getattr returns appropriate ones for us.
+ *
+ * @return: 0 on success
+ *      -ENAMETOOLONG if the name is too long for the image: see check_name()
+ *      -ENOENT if the directory it goes in doesn't exist
+ *      -EEXIST if the name is already taken
+ */
+static int cs1550_mkdir(const char *path, mode_t mode) {
+    print_debug(("Inside make directory path = %s\n", path));
+
+    (void) path;
+    (void) mode;
+
+    // get name
+    int result = 0;
+
+    struct path_info info;
+    parse_path(path, &info);
+
+    if (info.components == 0) {
+        result = -EEXIST;
+    } else {
+        cs1550_disk *disk = get_instance()->d;
+        long dir_block;
+
+        lock_namespace(true);
+        long parent = resolve_directory(disk, &info.parent);
+        result = parent == -1 ? -ENOENT : create_directory(disk, parent, &info.last, &dir_block);
+        unlock_namespace();
+    }
+
+    return result;
+}
+
+/*
+ * Removes a directory and gives its block back.
+ *
+ * @return: 0 on success
+ *      -ENOENT if the directory doesn't exist
+ *      -ENOTDIR if the path is a file
+ *      -ENOTEMPTY if the directory still has files
+ *      -EBUSY for the root
+ */
+static int cs1550_rmdir(const char *path) {
+    print_debug(("Inside remove directory path = %s\n", path));
+
+    int result = 0;
+
+    struct path_info info;
+    parse_path(path, &info);
+
+    if (info.components == 0) {
+        result = -EBUSY;
+    } else {
+        cs1550_disk *disk = get_instance()->d;
+
+        lock_namespace(true);
+
+        long parent = resolve_directory(disk, &info.parent);
+        result = parent == -1 ? -ENOENT : remove_directory(disk, parent, &info.last);
+        if (result == 0) {
+            struct path_view dir_path = {path, (int) strlen(path)};
+            dentry_remove(&get_instance()->dentries, &dir_path);
+        }
+
+        unlock_namespace();
+    }
+
+    return result;
+}
+
+
+/*
+ * Shared body of mknod and create: adds the file named by path and, if fi isn't NULL, opens it.
+ */
+static int make_file(const char *path, struct fuse_file_info *fi) {
+    int result = 0;
+
+    struct path_info info;
+    parse_path(path, &info);
+
+    print_debug(("parent = %.*s\n", info.parent.length, info.parent.start));
+    print_debug(("name = %.*s\n", info.last.length, info.last.start));
+
+    if (info.components < 2) {
+        // files only go in a directory below the root
+        result = -EPERM;
+    } else {
+        cs1550_disk *disk = get_instance()->d;
+
+        lock_namespace(false);
+
+        // go to the directory
+        long dir_block = resolve_directory(disk, &info.parent);
+        if (dir_block == -1) {
+            result = -EPERM;
+        } else {
+            long slot;
+
+            lock_directory(dir_block, true);
+            result = create_file(disk, dir_block, &info.last, &slot);
+            if (result == 0 && fi != NULL) {
+                struct open_file *handle = open_handle(dir_block, slot);
+                if (handle == NULL) {
+                    result = -ENOMEM;
+                }
+                fi->fh = (uint64_t) (uintptr_t) handle;
+            }
+            unlock_directory(dir_block);
+        }
+
+        unlock_namespace();
+    }
+
+    return result;
+}
+
+/**
+ * Does the actual creation of a file. Mode and dev can be ignored.
+ *
+ * This function should add a new file to a subdirectory, and should update the .disk file appropriately with the
+ * modified directory entry structure.
+ *
+ * @return:     0 on success
+ *      -ENAMETOOLONG if the name is too long for the image: see check_name()
+ *      -EPERM if the file is trying to be created in the root dir, or in a directory that doesn't exist
+ *      -EEXIST if the name is already taken
+ */
+static int cs1550_mknod(const char *path, mode_t mode, dev_t dev) {
+
+    print_debug(("I'm in mknod path = %s\n", path));
+
+    (void) mode;
+    (void) dev;
+
+    return make_file(path, NULL);
+}
+
+/*
+ * Creates a file and opens it in one go, saving the kernel a lookup and an open.
+ */
+static int cs1550_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
+
+    print_debug(("I'm in create path = %s\n", path));
+
+    (void) mode;
+
+    return make_file(path, fi);
+}
+
+/*
+ * Deletes a file and gives its blocks back.
+ *
+ * @return: 0 on success
+ *      -ENOENT if the file doesn't exist
+ *      -EISDIR if the path is a directory
+ */
+static int cs1550_unlink(const char *path) {
+    print_debug(("Inside unlink path = %s\n", path));
+
+    int result = -ENOENT;
+
+    struct path_info info;
+    parse_path(path, &info);
+
+    if (info.components == 0) {
+        result = -EISDIR;
+    } else {
+        cs1550_disk *disk = get_instance()->d;
+
+        lock_namespace(false);
+
+        long dir_block = resolve_directory(disk, &info.parent);
+        if (dir_block != -1) {
+            lock_directory(dir_block, true);
+
+            long m = lookup_file(disk, dir_block, &info);
+            if (m >= 0) {
+                remove_file(disk, dir_block, m);
+            }
+            result = m >= 0 ? 0 : (int) m;
+
+            unlock_directory(dir_block);
+        }
+
+        unlock_namespace();
+    }
+
+    return result;
+}
+
+/*
+ * Read size bytes from file into buf starting from offset
+ *
+ * @return: size read on success, less than size (down to 0) if the file ends first
+ *      -EISDIR if the path is a directory
+ */
+static int cs1550_read(const char *path, char *buf, size_t size, off_t offset,
+                       struct fuse_file_info *fi) {
+
+    print_debug(
+            ("I'm in cs1550_read: size = %ld offset = %ld\npath = %s\n", size, (long) offset, path));
+
+    ////    This function should read the data in the file denoted by path into buf, starting at offset.
+//    (void) buf;
+//    (void) offset;
+//    (void) fi;
+//    (void) path;
+//
+//    //check to make sure path exists
+//    //check that size is > 0
+//    //check that offset is <= to the file size
+//    //read in data
+//    //set size and return, or error
+//
+//    size = 0;
+//
+//    return (int) size;
 
-        if (i == strlen(path) - 1) { // at the end of the string
-            if (in_dir) {
-                substring(path, dir_name, path_index + 1, (int) ((strlen(path) - 1) - path_index));
-                strcpy(*full_file_name, "");
-                strcpy(*file_name, "");
-                strcpy(*extension_name, "");
-            } else if (in_file) {
-                substring(path, full_file_name, path_index + 1, (int) ((strlen(path) - 1) - path_index));
-                substring(path, file_name, path_index + 1, (dot_index - 1) - path_index);
-                substring(path, extension_name, dot_index + 1, (int) ((strlen(path) - 1) - dot_index));
-            } else {
-                //error
-            }
-        }
-    }
+    // open found the file already
+    return read_handle(get_instance()->d, (struct open_file *) (uintptr_t) fi->fh, buf, size, offset);
 }
 
+/*
+ * Write size bytes from buf into file starting from offset
+ *
+ * @return: size on success
+ *      -ENOSPC if the file has to grow and the disk is full
+ */
+static int cs1550_write(const char *path, const char *buf, size_t size,
+                        off_t offset, struct fuse_file_info *fi) {
+    ////    This function should write the data in buf into the file denoted by path, starting at offset.
+//    (void) buf;
+//    (void) offset;
+//    (void) fi;
+//    (void) path;
+//
+//    //check to make sure path exists
+//    //check that size is > 0
+//    //check that offset is <= to the file size
+//    //write data
+//    //set size (should be same as input) and return, or error
+//
+//    return (int) size;
+
+    (void) path;
 
-void substring(const char *src, char **dest, int start_position, int length) {
-    memcpy((*dest), &src[start_position], length);
-    (*dest)[length] = '\0';
-    print_debug(("Src %s length %d\n", src, (int) strlen(src)));
-    print_debug(("Dest %s length %d\n", *dest, (int) strlen(*dest)));
+    // open found the file already
+    return write_handle(get_instance()->d, (struct open_file *) (uintptr_t) fi->fh, buf, size, offset);
 }
 
-/*
- * Called whenever the system wants to know the file attributes, including
- * simply whether the file exists or not.
+/******************************************************************************
  *
- * man -s 2 stat will show the fields of a stat structure
+ *  DO NOT MODIFY ANYTHING BELOW THIS LINE
  *
- * @return: 0 on success, with a correctly set structure
- *      -ENOENT if the file is not found
+ *****************************************************************************/
+
+/*
+ * truncate is called when a new file is created (with a 0 size) or when an
+ * existing file is made shorter or longer. Blocks past a smaller size go back
+ * to the bitmap; a bigger size reads back as zeros.
+ *
+ * @return: 0 on success
+ *      -ENOENT if the file doesn't exist
+ *      -EISDIR if the path is a directory
+ *      -ENOSPC if the file has to grow and the disk is full
  */
-static int cs1550_getattr(const char *path, struct stat *stbuf) {
-    print_debug(("Inside cs1550_getattr = %s\n", path));
+static int cs1550_truncate(const char *path, off_t size) {
+    print_debug(("Inside truncate path = %s size = %ld\n", path, (long) size));
 
-    //default return that path doesn't exist
     int result = -ENOENT;
 
-    char *dir_name;
-    char *full_file_name;
-    char *file_name;
-    char *extension_name;
+    struct path_info info;
+    parse_path(path, &info);
 
-    get_path_info(path, &dir_name, &full_file_name, &file_name, &extension_name);
+    if (info.components == 0) {
+        result = -EISDIR;
+    } else {
+        cs1550_disk *disk = get_instance()->d;
 
-    print_debug(("dir_name: %s\n", dir_name));
-    print_debug(("full_file_name: %s\n", full_file_name));
-    print_debug(("file_name: %s\n", file_name));
-    print_debug(("extension_name: %s\n", extension_name));
+        lock_namespace(false);
 
-    memset(stbuf, 0, sizeof(struct stat));
+        long dir_block = resolve_directory(disk, &info.parent);
+        if (dir_block != -1) {
+            lock_directory(dir_block, true);
 
-    cs1550_disk *disk = get_instance()->d;
-    struct cs1550_root_directory *bitmapFileHeader = (struct cs1550_root_directory *) &disk->blocks[0];
-//    print_debug(("\n\nnDirectories %d\n\n", bitmapFileHeader->nDirectories));
+            long m = lookup_file(disk, dir_block, &info);
+            result = m >= 0 ? truncate_file(disk, dir_block, m, size) : (int) m;
 
-    // this will contain all of the information about the disk
-    //our bitmap file header
+            unlock_directory(dir_block);
+        }
 
-    //is path the root dir?
-    if (strcmp(path, "/") == 0) {
-        print_debug(("In get_path_info for root\n"));
-        print_debug(("\n\nnDirectories %d\n\n", bitmapFileHeader->nDirectories));
+        unlock_namespace();
+    }
 
-        stbuf->st_mode = S_IFDIR | 0755;
-        stbuf->st_nlink = 2;
-        result = 0;
-    } else {
+    return result;
+}
 
-        // if in double or + sub dir resturn not found
-        int j, slash_count = 0;
-        for (j = 0; j < strlen(path); ++j) {
-            if (path[j] == '/') {
-                slash_count++;
-            }
-        }
 
-        /*
-         * todo: this business logic is convoluted would do better to have a switch statement with 1) root, 2) subdir 3) subdir-subdir
-         */
-        // we have tried to create a file in a subdirectory of a subdirectory
-        if ((strlen(file_name) == 0) && slash_count >= 2) {
-            // this is used if the user tries to create a directory in a subdirectory
-            // result does not exist
-        } else if (strlen(full_file_name) == 0) {  // if in single sub dir
-            print_debug(("In get_path_info for dir\n"));
-            //Check if name is subdirectory
-            // if the directory exists
-            int i;
-            for (i = 0; i < bitmapFileHeader->nDirectories; ++i) {
+/*
+ * Called when we open a file
+ *
+ * The file is looked up here once, and everything done through fi afterwards goes straight to it.
+ *
+ * @return 0 on success
+ *      -ENOENT if the file doesn't exist
+ *      -EISDIR if path names a directory
+ */
+static int cs1550_open(const char *path, struct fuse_file_info *fi) {
+    int result = -ENOENT;
 
-                assert(bitmapFileHeader->directories[i].nStartBlock < sizeof(cs1550_disk_block) * NUMBER_OF_BLOCKS);
-                cs1550_directory_entry *entry = (cs1550_directory_entry *) &disk->blocks[bitmapFileHeader->directories[i].nStartBlock];
-                print_debug(("\n\nNumber of files %d\n\n", entry->nFiles));
-                print_debug(
-                        ("bitmap %s dir_name %s result %d\n", bitmapFileHeader->directories[i].dname, dir_name, strcmp(
-                                bitmapFileHeader->directories[i].dname, dir_name)));
+    struct path_info info;
+    parse_path(path, &info);
 
-                if (strcmp(bitmapFileHeader->directories[i].dname, dir_name) == 0) {
+    /* We're not going to worry about permissions for this project, but
+       if we were and we don't have them to the file we should return an error
 
-                    //Might want to return a structure with these fields
-                    stbuf->st_mode = S_IFDIR | 0755;
-                    stbuf->st_nlink = 2;
-                    result = 0; //no error
+        return -EACCES;
+    */
 
-                    break;
-                }
-            }
-        } else { // reading file
-            print_debug(("In get_path_info for file\n"));
+    if (info.components == 0) {
+        return -EISDIR;
+    }
 
-            int i;
-            for (i = 0; i < bitmapFileHeader->nDirectories; ++i) {
-                //    print_debug(("\n\nnDirectories %d\n\n", bitmapFileHeader->nDirectories));
-                print_debug(
-                        ("bitmap %s dir_name %s result %d\n", bitmapFileHeader->directories[i].dname, dir_name, strcmp(
-                                bitmapFileHeader->directories[i].dname, dir_name)));
-
-                if (strcmp(bitmapFileHeader->directories[i].dname, dir_name) == 0) {
-
-                    // get the cs1550_directory_entry
-                    assert(bitmapFileHeader->directories[i].nStartBlock < sizeof(cs1550_disk_block) * NUMBER_OF_BLOCKS);
-                    cs1550_directory_entry *entry = (cs1550_directory_entry *) &disk->blocks[bitmapFileHeader->directories[i].nStartBlock];
-
-                    print_debug(("entry->nFiles : %d\n", entry->nFiles));
-
-                    int m;
-                    for (m = 0; m < entry->nFiles; ++m) {
-                        print_debug(
-                                ("entry %s file_name %s result %d\n", entry->files[m].fname, file_name,
-                                        strcmp(entry->files[m].fname, file_name)));
-                        print_debug(
-                                ("entry %s extension_name %s result %d\n", entry->files[m].fext, extension_name,
-                                        strcmp(entry->files[m].fext, extension_name)));
-
-                        if (strcmp(entry->files[m].fname, file_name) == 0 &&
-                            strcmp(entry->files[m].fext, extension_name) == 0) {
-                            //Check if name is a regular file
-
-
-                            //regular file, probably want to be read and write
-                            stbuf->st_mode = S_IFREG | 0666;
-                            stbuf->st_nlink = 1; //file links
-                            stbuf->st_size = 0; //file size - make sure you replace with real size!
-                            result = 0; // no error
-                            break;
-                        }
-                    }
-                    break;
+    cs1550_disk *disk = get_instance()->d;
 
-                }
-            }
+    lock_namespace(false);
+
+    long dir_block = resolve_directory(disk, &info.parent);
+    if (dir_block != -1) {
+        lock_directory(dir_block, false);
+
+        long m = lookup_file(disk, dir_block, &info);
+        if (m >= 0) {
+            struct open_file *handle = open_handle(dir_block, m);
+            fi->fh = (uint64_t) (uintptr_t) handle;
+            result = handle != NULL ? 0 : -ENOMEM;
+        } else {
+            result = (int) m;
         }
+
+        unlock_directory(dir_block);
     }
 
-    free(dir_name);
-    free(file_name);
-    free(full_file_name);
-    free(extension_name);
+    unlock_namespace();
 
     return result;
 }
 
-
 /*
- * Called whenever the contents of a directory are desired. Could be from an 'ls'
- * or could even be when a user hits TAB to do autocompletion
- *
- * This function should look up the input path, ensuring that it is a directory, and then list the contents.
- *
- * To list the contents, you need to use the filler() function.  For example: filler(buf, ".", NULL, 0); adds the
- * current directory to the listing generated by ls -a
- *
- * In general, you will only need to change the second parameter to be the name of the file or directory you want to add
- * to the listing.
- *
- * @return: 0 on success
- *      -ENOENT if the directory is not valid or found
+ * Called once the last descriptor sharing fi is closed.
  */
-static int cs1550_readdir(const char *path,
-                          void *buf,
-                          fuse_fill_dir_t filler,
-                          off_t offset,
-                          struct fuse_file_info *fi) {
-
-    print_debug(("Inside read directory path = %s\n", path));
+static int cs1550_release(const char *path, struct fuse_file_info *fi) {
+    (void) path;
 
-    // list the contents of the directory at path
-    // that means I need to navigate to the path first
+    struct open_file *handle = (struct open_file *) (uintptr_t) fi->fh;
+    int result = flush_handle(get_instance()->d, handle);
+    close_handle(handle);
 
-    //Since we're building with -Wall (all warnings reported) we need
-    //to "use" every parameter, so let's just cast them to void to
-    //satisfy the compiler
+    return result;
+}
 
-    (void) offset;
-    (void) fi;
+/*
+ * Called when close is called on a file descriptor, but because it might
+ * have been dup'ed, this isn't a guarantee we won't ever need the file
+ * again. The file's write buffer gets its blocks here, so close() is where
+ * a full disk shows up.
+ */
+static int cs1550_flush(const char *path, struct fuse_file_info *fi) {
+    (void) path;
 
-    char *dir_name;
-    char *full_file_name;
-    char *file_name;
-    char *extension_name;
+    return flush_handle(get_instance()->d, (struct open_file *) (uintptr_t) fi->fh);
+}
 
-    get_path_info(path, &dir_name, &full_file_name, &file_name, &extension_name);
+/*
+ * Called by fsync and fdatasync. The file's write buffer gets its blocks, and then everything is committed and on the
+ * disk before this returns, unless the file system was mounted with sync=none.
+ */
+static int cs1550_fsync(const char *path, int datasync, struct fuse_file_info *fi) {
+    (void) path;
+    (void) datasync;
 
     cs1550_disk *disk = get_instance()->d;
-    struct cs1550_root_directory *bitmapFileHeader = (struct cs1550_root_directory *) &disk->blocks[0];
-//    print_debug(("\n\nnDirectories %d\n\n", bitmapFileHeader->nDirectories));
 
-    // this will contain all of the information about the disk
+    int result = flush_handle(disk, (struct open_file *) (uintptr_t) fi->fh);
+    return result == 0 ? sync_disk(disk) : result;
+}
 
-    filler(buf, ".", NULL, 0);
-    filler(buf, "..", NULL, 0);
+/*
+ * Called by fsync on a directory. Directories are metadata, which every commit carries, so this is a commit and a
+ * wait like cs1550_fsync().
+ */
+static int cs1550_fsyncdir(const char *path, int datasync, struct fuse_file_info *fi) {
+    (void) path;
+    (void) datasync;
+    (void) fi;
 
-    if (strcmp(path, "/") == 0) {
-        // todo: ineffeicient way to read. need to work on this because it is reading all directories. I just want the current directory
-        int i;
-        for (i = 0; i < bitmapFileHeader->nDirectories; ++i) {
-            filler(buf, bitmapFileHeader->directories[i].dname, NULL, 0);
-        }
-    } else {
+    return sync_disk(get_instance()->d);
+}
 
-        int i;
-        for (i = 0; i < bitmapFileHeader->nDirectories; ++i) {
+/*
+ * Called by df and by anyone who wants to know whether a large write will fit.
+ */
+static int cs1550_statfs(const char *path, struct statvfs *stbuf) {
+    (void) path;
 
-            if (strcmp(bitmapFileHeader->directories[i].dname, dir_name) == 0) {
-                print_debug(("I'm in this directory %s\n", dir_name));
+    stat_disk(get_instance()->d, stbuf);
+
+    return 0;
+}
 
-                // get the cs1550_directory_entry
-                assert(bitmapFileHeader->directories[i].nStartBlock < sizeof(cs1550_disk_block) * NUMBER_OF_BLOCKS);
-                cs1550_directory_entry *entry = (cs1550_directory_entry *) &disk->blocks[bitmapFileHeader->directories[i].nStartBlock];
-                print_debug(("Number of entries directory %d\n", entry->nFiles));
 
-                int j;
-                for (j = 0; j < entry->nFiles; ++j) {
+/*
+ * Called once the file system is mounted, before any other request. Opens and maps the image.
+ */
+static void *cs1550_init(struct fuse_conn_info *conn);
 
-                    char buff_full_file_name[MAX_FILENAME + MAX_EXTENSION + 1] = "";
+/*
+ * Called on unmount. Flushes anything still dirty and closes the image.
+ */
+static void cs1550_destroy(void *private_data);
 
-                    print_debug(("Before strcpy: buff_full_file_name %s\n", buff_full_file_name));
+//register our new functions as the implementations of the syscalls
+static struct fuse_operations hello_oper = {
+        .getattr    = cs1550_getattr,
+        .readdir    = cs1550_readdir,
+        .mkdir    = cs1550_mkdir,
+        .rmdir = cs1550_rmdir,
+        .read    = cs1550_read,
+        .write    = cs1550_write,
+        .mknod    = cs1550_mknod,
+        .create = cs1550_create,
+        .unlink = cs1550_unlink,
+        .truncate = cs1550_truncate,
+        .flush = cs1550_flush,
+        .open    = cs1550_open,
+        .release = cs1550_release,
+        .fsync = cs1550_fsync,
+        .fsyncdir = cs1550_fsyncdir,
+        .statfs = cs1550_statfs,
+        .init = cs1550_init,
+        .destroy = cs1550_destroy,
+};
 
-                    strcat(buff_full_file_name, entry->files[j].fname);
-                    print_debug(("file_name: %s\n", entry->files[j].fname));
+#endif //CS1550_LOWLEVEL
 
-                    strcat(buff_full_file_name, ".");
-                    strcat(buff_full_file_name, entry->files[j].fext);
-                    print_debug(("extension_name: %s\n", entry->files[j].fext));
+// how long, in seconds, the kernel may keep attributes and names; everything goes through this process, so nothing
+// changes behind its back
+#define CS1550_TIMEOUT 60
 
-                    print_debug(("After strcpy: buff_full_file_name %s\n", buff_full_file_name));
+#define STRINGIFY(x) #x
+#define TO_STRING(x) STRINGIFY(x)
 
-                    filler(buf, buff_full_file_name, NULL, 0);
-                }
-            }
-        }
-    }
+// mount options of our own, e.g. -o disk=/path/to/image,odirect,readahead=4096,writebuffer=0,sync=strict
+struct cs1550_options {
+    char *disk_path;
+    int direct_io;
+    int block_size;         //only used when the image is blank and gets formatted
+    int readahead_kb;       //largest readahead window in kilobytes, 0 for none
+    int write_buffer_kb;    //biggest write buffer of a file in kilobytes, 0 for none
+    char *sync;             //strict, batched or none
+    int commit_ms;          //how often the commit thread commits
+};
 
-    return 0;
-}
+static struct cs1550_options options;
+
+static struct fuse_opt cs1550_opts[] = {
+        {"disk=%s", offsetof(struct cs1550_options, disk_path), 0},
+        {"odirect", offsetof(struct cs1550_options, direct_io), 1},
+        {"blocksize=%d", offsetof(struct cs1550_options, block_size), 0},
+        {"readahead=%d", offsetof(struct cs1550_options, readahead_kb), 0},
+        {"writebuffer=%d", offsetof(struct cs1550_options, write_buffer_kb), 0},
+        {"sync=%s", offsetof(struct cs1550_options, sync), 0},
+        {"commit=%d", offsetof(struct cs1550_options, commit_ms), 0},
+        FUSE_OPT_END
+};
 
 /**
- * Creates a directory. We can ignore mode since we're not dealing with
- * permissions, as long as getattr returns appropriate ones for us.
+ * Takes our own options out of args and pins the image path down: init runs after fuse has daemonized and changed
+ * to "/", so a relative path would no longer resolve there.
  *
- * @return: 0 on success
- *      -ENAMETOOLONG if the name is beyond 8 chars
- *      -EPERM if the directory is not under the root dir only
- *      -EEXIST if the directory already exists
+ * @return EXIT_SUCCESS, EXIT_FAILURE if the options are bad or the image doesn't exist
  */
-static int cs1550_mkdir(const char *path, mode_t mode) {
-    print_debug(("Inside make directory path = %s\n", path));
-
-    (void) path;
-    (void) mode;
-
-    // get name
-    int result = 0;
-    int slash_count = 0;
-    int letter_count = 0;
-    const size_t str_length = strlen(path);
-
-    // start at one before the '\0'
-    int i;
-    for (i = (int) str_length - 1; i >= 0; --i) {
-
-        // if name is too long
-        if (letter_count > 8) {
-            result = -ENAMETOOLONG;
-            break;
-        }
-
-        if (path[i] == '/') {
-            slash_count++;
-            letter_count = 0; // reset letter count
-        } else {
-            letter_count++;
-        }
-
-        if (slash_count > 1) {
-            result = -EPERM;
-            break;
-        }
+static int parse_options(struct fuse_args *args) {
+    options.block_size = DEFAULT_BLOCK_SIZE;
+    options.readahead_kb = DEFAULT_READAHEAD_KB;
+    options.write_buffer_kb = DEFAULT_WRITE_BUFFER_KB;
+    options.commit_ms = COMMIT_INTERVAL_MS;
+
+    if (fuse_opt_parse(args, &options, cs1550_opts, NULL) == -1) {
+        return EXIT_FAILURE;
     }
 
-    // if directory is not under the root directory
-    // this means that the path information is off
+    if (options.sync != NULL && strcmp(options.sync, "strict") != 0 && strcmp(options.sync, "batched") != 0 &&
+        strcmp(options.sync, "none") != 0) {
+        fprintf(stderr, "cs1550: sync must be strict, batched or none, not %s\n", options.sync);
+        return EXIT_FAILURE;
+    }
+    if (options.commit_ms <= 0) {
+        fprintf(stderr, "cs1550: commit must be a number of milliseconds\n");
+        return EXIT_FAILURE;
+    }
 
-    if (result == 0) {
+    char *disk_path = realpath(options.disk_path != NULL ? options.disk_path : ".disk", NULL);
+    if (disk_path == NULL) {
+        fprintf(stderr, "cs1550: can't find disk image %s\n", options.disk_path != NULL ? options.disk_path : ".disk");
+        return EXIT_FAILURE;
+    }
+    free(options.disk_path);
+    options.disk_path = disk_path;
 
-        // minus 1 for '\0' minus 1 for '/' path character
-        print_debug(("Length %d\n", (int) str_length));
-        assert((str_length - 1) <= 8);
-        char file_name[str_length - 1];
-        memcpy(file_name, &path[1], str_length);
-        file_name[str_length - 1] = '\0';
-        print_debug(("file_name %s\n", file_name));
+    return EXIT_SUCCESS;
+}
 
-        cs1550_disk *disk = get_instance()->d;
-        struct cs1550_root_directory *bitmapFileHeader = (struct cs1550_root_directory *) &disk->blocks[0];
+/*
+ * The sync= mount option as one of SYNC_NONE, SYNC_BATCHED or SYNC_STRICT.
+ */
+static int sync_option(void) {
+    if (options.sync != NULL && strcmp(options.sync, "strict") == 0) {
+        return SYNC_STRICT;
+    }
+    return options.sync != NULL && strcmp(options.sync, "none") == 0 ? SYNC_NONE : SYNC_BATCHED;
+}
 
-        // if the directory exists
-        int j;
-        for (j = 0; j < bitmapFileHeader->nDirectories; ++j) {
+/*
+ * Opens the image with the mount options; shared by both front ends' init.
+ */
+static void open_options(void) {
+    int sync = sync_option();
+
+    // a strict reply means the write is on the disk, so nothing waits in a write buffer
+    open_instance(options.disk_path, options.direct_io, (size_t) options.block_size,
+                  options.readahead_kb > 0 ? (size_t) options.readahead_kb * 1024 : 0,
+                  options.write_buffer_kb > 0 && sync != SYNC_STRICT ? (size_t) options.write_buffer_kb * 1024 : 0,
+                  sync, options.commit_ms);
+}
 
-            if (strcmp(bitmapFileHeader->directories[j].dname, file_name) == 0) {
-                result = -EEXIST;
-                break;
-            }
-        }
+#ifndef CS1550_LOWLEVEL
 
-        if (bitmapFileHeader->nDirectories == MAX_DIRS_IN_ROOT) {
-            result = -EPERM;
-        }
+static void *cs1550_init(struct fuse_conn_info *conn) {
+    (void) conn;
 
-        // else create directory
-        if (result == 0) {
-            dirty = true;
+    open_options();
 
-            // loop through array
-            // we are adding a new directory therefor we can write directly to the end
-            strcpy(bitmapFileHeader->directories[bitmapFileHeader->nDirectories].dname, file_name);
+    return NULL;
+}
 
-            long start_block = get_free_block(disk->bitmap);
+static void cs1550_destroy(void *private_data) {
+    (void) private_data;
 
-            bitmapFileHeader->directories[bitmapFileHeader->nDirectories].nStartBlock = start_block;
-            set_bit_map((int) start_block, sizeof(struct cs1550_directory_entry), 1, disk->bitmap);
+    close_instance();
+}
 
-            long address = bitmapFileHeader->directories[bitmapFileHeader->nDirectories].nStartBlock;
-            assert(address < sizeof(cs1550_disk_block) * NUMBER_OF_BLOCKS);
+int main(int argc, char *argv[]) {
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
 
-            cs1550_directory_entry *new_entry = (cs1550_directory_entry *) &disk->blocks[address];
+    if (parse_options(&args) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
 
-            new_entry->nFiles = 0;
+    // report our inode numbers and let the kernel cache what getattr and lookups return instead of asking again on
+    // every stat; unlink an open file outright rather than have libfuse rename it out of the way, since there is no
+    // rename and open handles cope with their file going; put first so the command line still has the last word
+    fuse_opt_insert_arg(&args, 1, "-ouse_ino,hard_remove,entry_timeout=" TO_STRING(CS1550_TIMEOUT) ",attr_timeout="
+                                  TO_STRING(CS1550_TIMEOUT));
 
-            bitmapFileHeader->nDirectories++;
+    int result = fuse_main(args.argc, args.argv, &hello_oper, NULL);
 
-            write_to_disk(disk);
-            dirty = false;
-        }
-    }
+    fuse_opt_free_args(&args);
+    free(options.disk_path);
 
     return result;
 }
 
+#else //CS1550_LOWLEVEL
+
 /*
- * Removes a directory.
+ * The inode based front end on fuse_lowlevel_ops. The kernel addresses everything by node ID, and a node ID here is
+ * the inode number stat_entry() hands out, which the inode table turns back into a directory block and slot, so
+ * nothing is turned into a path and looked up again. Only lookup, mkdir, mknod, unlink and rmdir see names, and those
+ * are single names rather than paths.
+ *
+ * An inode number stays with its directory or file until that is removed, and is never handed out again while the
+ * image is mounted, so every entry carries generation 0 and a node ID the kernel still holds for a removed file
+ * decodes to -ENOENT rather than to another file.
  */
-static int cs1550_rmdir(const char *path) {
-    (void) path;
-    return 0;
-}
-
 
 /**
- * Does the actual creation of a file. Mode and dev can be ignored.
+ * Turns a node ID back into what it names.
  *
- * This function should add a new file to a subdirectory, and should update the .disk file appropriately with the
- * modified directory entry structure.
- *
- * @return:     0 on success
- *      -ENAMETOOLONG if the name is beyond 8.3 chars
- *      -EPERM if the file is trying to be created in the root dir
- *      -EEXIST if the file already exists
+ * @param dir_block set to the directory block, 0 for the root
+ * @param slot set to the slot of the file, -1 for a directory
+ * @return 0 on success
+ *      -ENOENT if the node ID doesn't name anything (any more), which also covers one from before a removal since
+ *      numbers aren't reused
  */
-static int cs1550_mknod(const char *path, mode_t mode, dev_t dev) {
-
-    print_debug(("I'm in mknod path = %s\n", path));
-
-    (void) mode;
-    (void) dev;
-
-    // get name
-    int result = 0;
-
-    char *dir_name;
-    char *full_file_name;
-    char *file_name;
-    char *extension_name;
+static int decode_inode(fuse_ino_t ino, long *dir_block, long *slot) {
+    return inode_place(&get_instance()->inodes, (ino_t) ino, dir_block, slot);
+}
 
-    result = get_path_info_for_mknod(path, &dir_name, &full_file_name, &file_name, &extension_name);
+/*
+ * A node ID leads to its directory's first block, which never changes, so the directory can be locked before the
+ * node ID is decoded again under the lock. A node ID that names nothing locks the root's stripe, and decodes to
+ * -ENOENT.
+ *
+ * @return the directory that was locked, to hand to unlock_inode()
+ */
+static long lock_inode(fuse_ino_t ino, int exclusive) {
+    long dir_block, slot;
 
-    print_debug(("dir_name = %s\n", dir_name));
-    print_debug(("full_file_name = %s\n", full_file_name));
-    print_debug(("file_name = %s\n", file_name));
-    print_debug(("extension_name = %s\n", extension_name));
+    lock_namespace(false);
 
-    cs1550_directory_entry *entry = NULL;
-    cs1550_disk *disk = get_instance()->d;
-    struct cs1550_root_directory *bitmapFileHeader = (struct cs1550_root_directory *) &disk->blocks[0];
+    if (decode_inode(ino, &dir_block, &slot) != 0) {
+        dir_block = 0;
+    }
+    lock_directory(dir_block, exclusive);
 
-    int m = 0;
+    return dir_block;
+}
 
-    if (strcmp(path, "/") == 0) {
+static void unlock_inode(long dir_block) {
+    unlock_directory(dir_block);
+    unlock_namespace();
+}
 
-        result = -EPERM;
-    }
+static void fill_entry(struct fuse_entry_param *e, cs1550_disk *disk, long dir_block, long slot) {
+    memset(e, 0, sizeof(*e));
+    e->ino = inode_number(&get_instance()->inodes, dir_block, slot);
+    e->attr_timeout = CS1550_TIMEOUT;
+    e->entry_timeout = CS1550_TIMEOUT;
+    stat_entry(disk, dir_block, slot, &e->attr);
+}
 
-    if (result == 0) {
-        // go to the directory
-        int found_dir = false;
-        int l;
-        for (l = 0; l < bitmapFileHeader->nDirectories; ++l) {
+static void reply_entry(fuse_req_t req, cs1550_disk *disk, long dir_block, long slot) {
+    struct fuse_entry_param e;
 
-            if (strcmp(bitmapFileHeader->directories[l].dname, dir_name) == 0) {
-                // i found the directory
-                found_dir = true;
+    fill_entry(&e, disk, dir_block, slot);
+    fuse_reply_entry(req, &e);
+}
 
-                // get the cs1550_directory_entry
-                assert(bitmapFileHeader->directories[l].nStartBlock < sizeof(cs1550_disk_block) * NUMBER_OF_BLOCKS);
-                entry = (cs1550_directory_entry *) &disk->blocks[bitmapFileHeader->directories[l].nStartBlock];
+static void cs1550_ll_init(void *userdata, struct fuse_conn_info *conn) {
+    (void) userdata;
+    (void) conn;
 
-                if (entry->nFiles == MAX_FILES_IN_DIR) {
-                    result = -EPERM;
-                    break;
-                }
+    open_options();
+}
 
-                for (m = 0; m < entry->nFiles; ++m) {
-                    if (strcmp(entry->files[m].fname, file_name) == 0 &&
-                        strcmp(entry->files[m].fext, extension_name) == 0) {
-                        result = -EEXIST;
-                        break;
-                    }
-                }
-                break;
-            }
-        }
+static void cs1550_ll_destroy(void *userdata) {
+    (void) userdata;
 
-        if (!found_dir) {
-            result = -EPERM;
+    close_instance();
+}
 
-            // todo: allow user to create directory and file in the same operation
-//            int mkdir_result = cs1550_mkdir(path, (mode_t) NULL);
-//            print_debug(("Result of mkdir: %d\n", mkdir_result));
-//
-//            if (mkdir_result != 0) {
-//                result = -EPERM;
-//            }
+static void cs1550_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name) {
+    cs1550_disk *disk = get_instance()->d;
+    long dir_block, slot;
+
+    long locked = lock_inode(parent, false);
+
+    int result = decode_inode(parent, &dir_block, &slot);
+
+    if (result == 0 && slot != -1) {
+        result = -ENOTDIR;
+    } else if (result == 0) {
+        // a directory, or else a file; the root only holds directories
+        struct path_view dir_name = {name, (int) strlen(name)};
+        long child = find_directory(disk, dir_block, &dir_name);
+        if (child != -1) {
+            dir_block = child;
+        } else if (dir_block != 0) {
+            slot = find_file(disk, dir_block, &dir_name);
         }
+        result = child == -1 && slot == -1 ? -ENOENT : 0;
     }
 
-    // create file;
     if (result == 0) {
+        reply_entry(req, disk, dir_block, slot);
+    } else {
+        fuse_reply_err(req, -result);
+    }
 
-        dirty = true;
-        assert(entry != NULL);
-
-        print_debug(("Creating file entry\n"));
-        // m is the current position in the directory structure for me to store the file
-        // entry is a pointer to the subdirectory
+    unlock_inode(locked);
+}
 
-        entry->nFiles++;
+/*
+ * Node IDs aren't counted: one stays good for as long as what it names is there, whatever the kernel still holds, so
+ * there is nothing to let go of.
+ */
+static void cs1550_ll_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup) {
+    (void) ino;
+    (void) nlookup;
 
-        strcpy(entry->files[m].fname, file_name);
-        print_debug(("file_name: %s\n", entry->files[m].fname));
+    fuse_reply_none(req);
+}
 
-        strcpy(entry->files[m].fext, extension_name);
-        print_debug(("extension_name: %s\n", entry->files[m].fext));
+static void cs1550_ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    cs1550_disk *disk = get_instance()->d;
+    long dir_block, slot;
+    struct stat stbuf;
 
-        // get proper file size; note that this seems to be given to the write call
-        // will try to do this stuff when I write to the file for the first time.
+    (void) fi;
 
-        entry->files[m].fsize = 0;
-        entry->files[m].nStartBlock = 0;
+    long locked = lock_inode(ino, false);
 
-        write_to_disk(disk);
-        dirty = false;
+    int result = decode_inode(ino, &dir_block, &slot);
+    if (result == 0) {
+        stat_entry(disk, dir_block, slot, &stbuf);
     }
 
-    free(dir_name);
-    free(file_name);
-    free(full_file_name);
-    free(extension_name);
-
-    return result;
-}
-
-/*
- * Deletes a file
- *
- * This function should not be modified.
- */
-static int cs1550_unlink(const char *path) {
-    (void) path;
+    unlock_inode(locked);
 
-    return 0;
+    if (result == 0) {
+        fuse_reply_attr(req, &stbuf, CS1550_TIMEOUT);
+    } else {
+        fuse_reply_err(req, -result);
+    }
 }
 
 /*
- * Read size bytes from file into buf starting from offset
- *
- * @return: size read on success
- *      -EISDIR if the path is a directory
+ * The size and the time of the last change can be set. The mode and owner are fixed, and the time of the last access
+ * isn't kept apart from the time of the last change, so setting any of those on its own is refused.
  */
-static int cs1550_read(const char *path, char *buf, size_t size, off_t offset,
-                       struct fuse_file_info *fi) {
-
-    print_debug(
-            ("I'm in cs1550_read: size = %ld offset = %ld\npath = %s\nbuffer = %s\n", size, (long) offset, path, buf));
+static void cs1550_ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set,
+                              struct fuse_file_info *fi) {
+    cs1550_disk *disk = get_instance()->d;
+    long dir_block, slot;
+    int result = 0;
 
-    ////    This function should read the data in the file denoted by path into buf, starting at offset.
-//    (void) buf;
-//    (void) offset;
-    (void) size;
-    (void) fi;
-//    (void) path;
-//
-//    //check to make sure path exists
-//    //check that size is > 0
-//    //check that offset is <= to the file size
-//    //read in data
-//    //set size and return, or error
-//
-//    size = 0;
-//
-//    return (int) size;
+    if ((to_set & (FUSE_SET_ATTR_MODE | FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID)) ||
+        ((to_set & FUSE_SET_ATTR_ATIME) && !(to_set & FUSE_SET_ATTR_MTIME))) {
+        result = -EPERM;
+    }
 
-    int result = 0;
-    char *dir_name;
-    char *full_file_name;
-    char *file_name;
-    char *extension_name;
+    if (result == 0 && (to_set & (FUSE_SET_ATTR_SIZE | FUSE_SET_ATTR_MTIME))) {
+        long locked = lock_inode(ino, true);
 
-    get_path_info(path, &dir_name, &full_file_name, &file_name, &extension_name);
+        result = decode_inode(ino, &dir_block, &slot);
+        if (result == 0 && slot == -1 && (to_set & FUSE_SET_ATTR_SIZE)) {
+            result = -EISDIR;
+        }
+        if (result == 0 && (to_set & FUSE_SET_ATTR_SIZE)) {
+            result = truncate_file(disk, dir_block, slot, attr->st_size);
+        }
+        if (result == 0 && (to_set & FUSE_SET_ATTR_MTIME)) {
+            set_mtime(disk, dir_block, slot, attr->st_mtime);
+        }
 
-    if (strlen(full_file_name) == 0) {
-        result = -EISDIR;
+        unlock_inode(locked);
     }
 
     if (result == 0) {
+        cs1550_ll_getattr(req, ino, fi);
+    } else {
+        fuse_reply_err(req, -result);
+    }
+}
 
-        cs1550_directory_entry *entry = NULL;
-        cs1550_disk *disk = get_instance()->d;
-        struct cs1550_root_directory *bitmapFileHeader = (struct cs1550_root_directory *) &disk->blocks[0];
-
-        print_debug(("In cs1550_read for file\n"));
+// a readdir reply being put together, as in example/hello_ll.c
+struct dirbuf {
+    char *p;
+    size_t size;
+};
 
-        int i;
-        for (i = 0; i < bitmapFileHeader->nDirectories; ++i) {
+static void dirbuf_add(fuse_req_t req, struct dirbuf *b, const char *name, fuse_ino_t ino, mode_t mode) {
+    struct stat stbuf;
+    size_t oldsize = b->size;
 
-            if (strcmp(bitmapFileHeader->directories[i].dname, dir_name) == 0) {
+    b->size += fuse_add_direntry(req, NULL, 0, name, NULL, 0);
+    b->p = (char *) realloc(b->p, b->size);
+    memset(&stbuf, 0, sizeof(stbuf));
+    stbuf.st_ino = ino;
+    stbuf.st_mode = mode;
+    fuse_add_direntry(req, b->p + oldsize, b->size - oldsize, name, &stbuf, (off_t) b->size);
+}
 
-                // entry is a pointer to the subdirectory
+static void cs1550_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi) {
+    cs1550_disk *disk = get_instance()->d;
+    long dir_block, slot;
 
-                assert(bitmapFileHeader->directories[i].nStartBlock < sizeof(cs1550_disk_block) * NUMBER_OF_BLOCKS);
-                entry = (cs1550_directory_entry *) &disk->blocks[bitmapFileHeader->directories[i].nStartBlock];
+    (void) fi;
 
-                print_debug(
-                        ("bitmap %s dir_name %s result %d\n", bitmapFileHeader->directories[i].dname, dir_name, strcmp(
-                                bitmapFileHeader->directories[i].dname, dir_name)));
-                print_debug(("entry->nFiles : %d\n", entry->nFiles));
+    long locked = lock_inode(ino, false);
 
-                int m;
-                for (m = 0; m < entry->nFiles; ++m) {
+    int result = decode_inode(ino, &dir_block, &slot);
+    if (result == 0 && slot != -1) {
+        result = -ENOTDIR;
+    }
+    if (result != 0) {
+        unlock_inode(locked);
+        fuse_reply_err(req, -result);
+        return;
+    }
 
-                    if (strcmp(entry->files[m].fname, file_name) == 0 &&
-                        strcmp(entry->files[m].fext, extension_name) == 0) {
+    struct inode_table *inodes = &get_instance()->inodes;
+    struct dirbuf b;
+    memset(&b, 0, sizeof(b));
+    dirbuf_add(req, &b, ".", ino, S_IFDIR);
+    dirbuf_add(req, &b, "..", inode_parent(inodes, ino), S_IFDIR);
 
-                        print_debug(("Reading file\n"));
-                        print_debug(("file_name: %s\n", entry->files[m].fname));
-                        print_debug(("extension_name: %s\n", entry->files[m].fext));
+    char name[MAX_NAME + 1];
 
+    if (ino == FUSE_ROOT_ID) {
+        long block;
+        for (block = disk->root_block; block != 0; block = next_directory_block(disk, block)) {
+            struct cs1550_root_directory *root = (struct cs1550_root_directory *) block_address(disk, block);
+            int i;
+            for (i = 0; i < root->nDirectories; ++i) {
+                root_name(disk, &root->directories[i], name);
+                dirbuf_add(req, &b, name, inode_number(inodes, root->directories[i].nStartBlock, -1), S_IFDIR);
+            }
+        }
+    } else {
+        long block;
+        for (block = dir_block; block != 0; block = next_directory_block(disk, block)) {
+            cs1550_directory_entry *entry = (cs1550_directory_entry *) block_address(disk, block);
+            int j;
+            for (j = 0; j < entry->nFiles; ++j) {
+                entry_name(disk, &entry->files[j], name);
+                if (IS_SUBDIRECTORY(&entry->files[j])) {
+                    dirbuf_add(req, &b, name, inode_number(inodes, entry->files[j].nStartBlock, -1), S_IFDIR);
+                } else {
+                    dirbuf_add(req, &b, name, inode_number(inodes, dir_block, make_slot(block, j)), S_IFREG);
+                }
+            }
+        }
+    }
 
-                        int fd;
+    unlock_inode(locked);
 
-                        // need to read from disk
-                        fd = open(".disk", O_RDONLY);
-                        if (fd == -1) {
-                            result = -EBADF;
-                        }
+    if ((size_t) off < b.size) {
+        fuse_reply_buf(req, b.p + off, b.size - off < size ? b.size - off : size);
+    } else {
+        fuse_reply_buf(req, NULL, 0);
+    }
+    free(b.p);
+}
 
-                        if (result == 0) {
-                            result = (int) pread(fd, buf, entry->files[m].fsize, entry->files[m].nStartBlock);
-                            print_debug(("result after pread = %d\n", result));
-                            print_debug(("result after buf = %s\n", buf));
-                        }
+static void cs1550_ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode) {
+    cs1550_disk *disk = get_instance()->d;
+    struct path_view dir_name = {name, (int) strlen(name)};
+    long dir_block, slot;
 
-                        if (result >= 0) {
-                            result = (int) entry->files[m].fsize;
-                            print_debug(("size = %d\n", result));
-                        }
+    (void) mode;
 
-                        close(fd);
+    // adding a directory changes the tree, which nobody else is looking at while this is held
+    lock_namespace(true);
 
-                        break;
-                    }
-                }
-                break;
-            }
-        }
+    int result = decode_inode(parent, &dir_block, &slot);
+    if (result == 0 && slot != -1) {
+        result = -ENOTDIR;
+    }
+    if (result == 0) {
+        result = create_directory(disk, dir_block, &dir_name, &dir_block);
+    }
+    if (result == 0) {
+        reply_entry(req, disk, dir_block, -1);
+    } else {
+        fuse_reply_err(req, -result);
     }
 
-    return result;
+    unlock_namespace();
 }
 
 /*
- * Write size bytes from buf into file starting from offset
- *
- * @return: size on success
- *      -EFBIG if the offset is beyond the file size (but handle appends)
- *          // it was ambiguous on how to handle appends.
- *          // assume that append means writing to a location within the bounds of the initial file size
+ * Shared body of mknod and create: adds the file and, if fi isn't NULL, opens it.
  */
-static int cs1550_write(const char *path, const char *buf, size_t size,
-                        off_t offset, struct fuse_file_info *fi) {
-    print_debug(
-            ("I'm in cs1550_write: size = %ld offset = %ld\npath = %s\nbuffer = %s\n", size, (long) offset, path, buf));
-
-    ////    This function should write the data in buf into the file denoted by path, starting at offset.
-//    (void) buf;
-//    (void) offset;
-    (void) fi;
-//    (void) path;
-//
-//    //check to make sure path exists
-//    //check that size is > 0
-//    //check that offset is <= to the file size
-//    //write data
-//    //set size (should be same as input) and return, or error
-//
-//    return (int) size;
+static void make_file(fuse_req_t req, fuse_ino_t parent, const char *name, struct fuse_file_info *fi) {
+    cs1550_disk *disk = get_instance()->d;
+    long dir_block, slot;
 
-    int result = 0;
+    long locked = lock_inode(parent, true);
 
-    char *dir_name;
-    char *full_file_name;
-    char *file_name;
-    char *extension_name;
+    // files only go in a directory below the root
+    int result = parent == FUSE_ROOT_ID ? -EPERM : decode_inode(parent, &dir_block, &slot);
+    if (result == 0 && slot != -1) {
+        result = -ENOTDIR;
+    }
+    if (result == 0) {
+        struct path_view file_name = {name, (int) strlen(name)};
+        result = create_file(disk, dir_block, &file_name, &slot);
+    }
+    if (result == 0 && fi != NULL) {
+        struct open_file *handle = open_handle(dir_block, slot);
+        fi->fh = (uint64_t) (uintptr_t) handle;
+        result = handle != NULL ? 0 : -ENOMEM;
+    }
 
-    get_path_info(path, &dir_name, &full_file_name, &file_name, &extension_name);
+    if (result == 0 && fi != NULL) {
+        struct fuse_entry_param e;
+        fill_entry(&e, disk, dir_block, slot);
+        fuse_reply_create(req, &e, fi);
+    } else if (result == 0) {
+        reply_entry(req, disk, dir_block, slot);
+    } else {
+        fuse_reply_err(req, -result);
+    }
 
-    cs1550_directory_entry *entry = NULL;
-    cs1550_disk *disk = get_instance()->d;
-    struct cs1550_root_directory *bitmapFileHeader = (struct cs1550_root_directory *) &disk->blocks[0];
+    unlock_inode(locked);
+}
 
-    print_debug(("In cs1550_write for file\n"));
+static void cs1550_ll_mknod(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, dev_t rdev) {
+    (void) mode;
+    (void) rdev;
 
-    int i;
-    for (i = 0; i < bitmapFileHeader->nDirectories; ++i) {
-        //    print_debug(("\n\nnDirectories %d\n\n", bitmapFileHeader->nDirectories));
+    make_file(req, parent, name, NULL);
+}
 
+static void cs1550_ll_create(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode,
+                             struct fuse_file_info *fi) {
+    (void) mode;
 
-        if (strcmp(bitmapFileHeader->directories[i].dname, dir_name) == 0) {
+    make_file(req, parent, name, fi);
+}
 
-            // entry is a pointer to the subdirectory
-            assert(bitmapFileHeader->directories[i].nStartBlock < sizeof(cs1550_disk_block) * NUMBER_OF_BLOCKS);
-            entry = (cs1550_directory_entry *) &disk->blocks[bitmapFileHeader->directories[i].nStartBlock];
+static void cs1550_ll_unlink(fuse_req_t req, fuse_ino_t parent, const char *name) {
+    cs1550_disk *disk = get_instance()->d;
+    long dir_block, slot;
 
-            print_debug(
-                    ("bitmap %s dir_name %s result %d\n", bitmapFileHeader->directories[i].dname, dir_name, strcmp(
-                            bitmapFileHeader->directories[i].dname, dir_name)));
-            print_debug(("entry->nFiles : %d\n", entry->nFiles));
+    long locked = lock_inode(parent, true);
 
-            int m;
-            for (m = 0; m < entry->nFiles; ++m) {
+    int result = parent == FUSE_ROOT_ID ? -EISDIR : decode_inode(parent, &dir_block, &slot);
+    if (result == 0 && slot != -1) {
+        result = -ENOTDIR;
+    }
+    if (result == 0) {
+        struct path_view file_name = {name, (int) strlen(name)};
+        slot = find_entry(disk, dir_block, &file_name);
+        if (slot == -1) {
+            result = -ENOENT;
+        } else if (IS_SUBDIRECTORY(slot_file(disk, slot))) {
+            result = -EISDIR;
+        } else {
+            remove_file(disk, dir_block, slot);
+        }
+    }
 
-                // m is the current position in the directory structure for me to store the file
-                if (strcmp(entry->files[m].fname, file_name) == 0 &&
-                    strcmp(entry->files[m].fext, extension_name) == 0) {
+    unlock_inode(locked);
 
+    fuse_reply_err(req, -result);
+}
 
-                    print_debug(("Writing to file\n"));
-                    print_debug(("file_name: %s\n", entry->files[m].fname));
-                    print_debug(("extension_name: %s\n", entry->files[m].fext));
+static void cs1550_ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name) {
+    cs1550_disk *disk = get_instance()->d;
+    struct path_view dir_name = {name, (int) strlen(name)};
+    long dir_block, slot;
 
-                    if (entry->files[m].nStartBlock == 0) {
+    lock_namespace(true);
 
-                        print_debug(("First time writing to file\n"));
+    int result = decode_inode(parent, &dir_block, &slot);
+    if (result == 0 && slot != -1) {
+        result = -ENOTDIR;
+    }
+    if (result == 0) {
+        result = remove_directory(disk, dir_block, &dir_name);
+    }
 
-                        // check to see that there is room left on the disk
-                        if (get_free_block(disk->bitmap) + size > SIZE_OF_DISK) {
-                            result = -EFBIG;
-                        } else {
-                            dirty = true;
-                            entry->files[m].nStartBlock = get_free_block(disk->bitmap);
-                            entry->files[m].fsize = size;
-                            set_bit_map((int) entry->files[m].nStartBlock, (int) entry->files[m].fsize, 1,
-                                        disk->bitmap);
-                            write_to_disk(disk);
-                            dirty = false;
-                        }
-                    }
+    unlock_namespace();
 
-                    /* Finished with dealing with writing to information blocks */
+    fuse_reply_err(req, -result);
+}
 
-                    if (offset + size > entry->files[m].fsize) {
-                        result = -EFBIG;
-                    } else {
-                        int fd;
+static void cs1550_ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    long dir_block, slot;
 
-                        // need to write to .disk
-                        fd = open(".disk", O_WRONLY);
-                        if (fd == -1) {
-                            result = -EBADF;
-                        }
+    long locked = lock_inode(ino, false);
 
-                        if (result == 0) {
-                            result = (int) pwrite(fd, buf, size, entry->files[m].nStartBlock + offset);
-                            print_debug(("result after pwrite = %d\n", result));
-                            print_debug(("result after buf = %s\n", buf));
-                        }
+    int result = decode_inode(ino, &dir_block, &slot);
+    if (result == 0 && slot == -1) {
+        result = -EISDIR;
+    }
+    if (result == 0) {
+        // the file's slot may change once others are removed; the handle keeps up with it
+        struct open_file *handle = open_handle(dir_block, slot);
+        fi->fh = (uint64_t) (uintptr_t) handle;
+        result = handle != NULL ? 0 : -ENOMEM;
+    }
 
-                        if (result >= 0) {
-                            result = (int) size;
-                            print_debug(("size = %d\n", result));
-                        }
+    unlock_inode(locked);
 
-                        close(fd);
-                    }
-                    break;
-                }
-            }
-            break;
-        }
+    if (result == 0) {
+        fuse_reply_open(req, fi);
+    } else {
+        fuse_reply_err(req, -result);
     }
+}
 
-    return result;
+static void cs1550_ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    (void) ino;
+
+    struct open_file *handle = (struct open_file *) (uintptr_t) fi->fh;
+    int result = flush_handle(get_instance()->d, handle);
+    close_handle(handle);
+    fuse_reply_err(req, -result);
 }
 
-/******************************************************************************
- *
- *  DO NOT MODIFY ANYTHING BELOW THIS LINE
- *
- *****************************************************************************/
+static void cs1550_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi) {
+    (void) ino;
 
-/*
- * truncate is called when a new file is created (with a 0 size) or when an
- * existing file is made shorter. We're not handling deleting files or
- * truncating existing ones, so all we need to do here is to initialize
- * the appropriate directory entry.
- *
- * This function should not be modified.
- *
- */
-static int cs1550_truncate(const char *path, off_t size) {
-    (void) path;
-    (void) size;
+    char *buf = malloc(size);
+    if (buf == NULL) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
 
-    return 0;
+    int result = read_handle(get_instance()->d, (struct open_file *) (uintptr_t) fi->fh, buf, size, off);
+
+    if (result >= 0) {
+        fuse_reply_buf(req, buf, (size_t) result);
+    } else {
+        fuse_reply_err(req, -result);
+    }
+    free(buf);
 }
 
+static void cs1550_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t off,
+                            struct fuse_file_info *fi) {
+    (void) ino;
 
-/*
- * Called when we open a file
- *
- * This function should not be modified, as you get the full path every time any of the other functions are called.
- *
- */
-static int cs1550_open(const char *path, struct fuse_file_info *fi) {
-    (void) path;
-    (void) fi;
-    /*
-        //if we can't find the desired file, return an error
-        return -ENOENT;
-    */
+    int result = write_handle(get_instance()->d, (struct open_file *) (uintptr_t) fi->fh, buf, size, off);
+
+    if (result >= 0) {
+        fuse_reply_write(req, (size_t) result);
+    } else {
+        fuse_reply_err(req, -result);
+    }
+}
 
-    //It's not really necessary for this project to anything in open
+static void cs1550_ll_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    (void) ino;
 
-    /* We're not going to worry about permissions for this project, but
-       if we were and we don't have them to the file we should return an error
+    fuse_reply_err(req, -flush_handle(get_instance()->d, (struct open_file *) (uintptr_t) fi->fh));
+}
 
-        return -EACCES;
-    */
+static void cs1550_ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi) {
+    (void) ino;
+    (void) datasync;
 
-    return 0; //success!
+    cs1550_disk *disk = get_instance()->d;
+
+    int result = flush_handle(disk, (struct open_file *) (uintptr_t) fi->fh);
+    fuse_reply_err(req, -(result == 0 ? sync_disk(disk) : result));
 }
 
-/*
- * Called when close is called on a file descriptor, but because it might
- * have been dup'ed, this isn't a guarantee we won't ever need the file
- * again. For us, return success simply to avoid the unimplemented error
- * in the debug log.
- *
- * This function should not be modified.
- */
-static int cs1550_flush(const char *path, struct fuse_file_info *fi) {
-    (void) path;
+static void cs1550_ll_fsyncdir(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi) {
+    (void) ino;
+    (void) datasync;
     (void) fi;
 
-    return 0; //success!
+    fuse_reply_err(req, -sync_disk(get_instance()->d));
 }
 
+static void cs1550_ll_statfs(fuse_req_t req, fuse_ino_t ino) {
+    struct statvfs stbuf;
 
-//register our new functions as the implementations of the syscalls
-static struct fuse_operations hello_oper = {
-        .getattr    = cs1550_getattr,
-        .readdir    = cs1550_readdir,
-        .mkdir    = cs1550_mkdir,
-        .rmdir = cs1550_rmdir,
-        .read    = cs1550_read,
-        .write    = cs1550_write,
-        .mknod    = cs1550_mknod,
-        .unlink = cs1550_unlink,
-        .truncate = cs1550_truncate,
-        .flush = cs1550_flush,
-        .open    = cs1550_open,
+    (void) ino;
+
+    stat_disk(get_instance()->d, &stbuf);
+    fuse_reply_statfs(req, &stbuf);
+}
+
+static struct fuse_lowlevel_ops cs1550_ll_oper = {
+        .init = cs1550_ll_init,
+        .destroy = cs1550_ll_destroy,
+        .lookup = cs1550_ll_lookup,
+        .forget = cs1550_ll_forget,
+        .getattr = cs1550_ll_getattr,
+        .setattr = cs1550_ll_setattr,
+        .readdir = cs1550_ll_readdir,
+        .mkdir = cs1550_ll_mkdir,
+        .mknod = cs1550_ll_mknod,
+        .create = cs1550_ll_create,
+        .unlink = cs1550_ll_unlink,
+        .rmdir = cs1550_ll_rmdir,
+        .open = cs1550_ll_open,
+        .release = cs1550_ll_release,
+        .read = cs1550_ll_read,
+        .write = cs1550_ll_write,
+        .flush = cs1550_ll_flush,
+        .fsync = cs1550_ll_fsync,
+        .fsyncdir = cs1550_ll_fsyncdir,
+        .statfs = cs1550_ll_statfs,
 };
 
-//Don't change this.
 int main(int argc, char *argv[]) {
-    return fuse_main(argc, argv, &hello_oper, NULL);
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    struct fuse_chan *ch;
+    char *mountpoint;
+    int multithreaded;
+    int foreground;
+    int err = -1;
+
+    if (parse_options(&args) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    if (fuse_parse_cmdline(&args, &mountpoint, &multithreaded, &foreground) != -1 &&
+        (ch = fuse_mount(mountpoint, &args)) != NULL) {
+        struct fuse_session *se;
+
+        se = fuse_lowlevel_new(&args, &cs1550_ll_oper, sizeof(cs1550_ll_oper), NULL);
+        if (se != NULL) {
+            if (fuse_daemonize(foreground) != -1 && fuse_set_signal_handlers(se) != -1) {
+                fuse_session_add_chan(se, ch);
+                err = multithreaded ? fuse_session_loop_mt(se) : fuse_session_loop(se);
+                fuse_remove_signal_handlers(se);
+                fuse_session_remove_chan(ch);
+            }
+            fuse_session_destroy(se);
+        }
+        fuse_unmount(mountpoint, ch);
+    }
+    fuse_opt_free_args(&args);
+    free(options.disk_path);
+
+    return err ? EXIT_FAILURE : EXIT_SUCCESS;
 }
+
+#endif //CS1550_LOWLEVEL
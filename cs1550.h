@@ -0,0 +1,341 @@
+/*
+    On-disk format of a cs1550 image, shared by the file system and mkfs.cs1550.
+
+    Edited by Betsalel "Saul" Williamson
+    saul.williamson@pitt.edu
+*/
+
+#ifndef CS1550_H
+#define CS1550_H
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+
+//size of a disk block when a blank image gets formatted; an existing image says what it uses in its superblock
+#define    DEFAULT_BLOCK_SIZE 4096
+#define    MIN_BLOCK_SIZE 512
+#define    MAX_BLOCK_SIZE 65536
+
+//names are kept in name blocks, away from the entries, and can be this long
+#define    MAX_NAME 255
+
+//The attribute packed means to not align these things
+struct cs1550_directory_entry {
+    int nFiles;    //How many files are in this block of the directory.
+    //Needs to be less than MAX_FILES_IN_DIR
+
+    struct cs1550_file_directory {
+        uint32_t nameHash;               //NAME_HASH of the whole name
+        uint64_t nameLocation;           //NAME_LOCATION of the name in a name block
+        uint8_t nameLength;              //bytes of the name, no nul
+        size_t fsize;                    //file size
+        long nStartBlock;                //where the first block is on disk
+        long nBlocks;                    //how many blocks in a row start there, 0 if nothing is allocated yet
+        long nExtentBlock;               //block holding the rest of the extents, 0 if the first one is all
+    } __attribute__((packed)) files[];    //There is an array of these, as many as fit in one block
+} __attribute__((packed));
+
+/*
+ * An entry of a directory can be a subdirectory rather than a file: its fsize is SUBDIRECTORY_SIZE and nStartBlock is
+ * the first block of the subdirectory, which is laid out like any other directory. The root holds directories only.
+ */
+#define SUBDIRECTORY_SIZE ((size_t) -1)
+#define IS_SUBDIRECTORY(file) ((file)->fsize == SUBDIRECTORY_SIZE)
+
+//How many files can there be in one directory block? Each also has its cs1550_attributes.
+#define MAX_FILES_IN_DIR(disk) \
+    (((disk)->block_size - sizeof(int) - DIRECTORY_TRAILER_SIZE) / \
+     (sizeof(struct cs1550_file_directory) + sizeof(struct cs1550_attributes)))
+
+typedef struct cs1550_root_directory cs1550_root_directory;
+
+struct cs1550_root_directory {
+    int nDirectories;    //How many subdirectories are in this block of the root
+    //Needs to be less than MAX_DIRS_IN_ROOT
+    struct cs1550_directory {
+        uint64_t nameLocation;           //NAME_LOCATION of the name in a name block
+        uint8_t nameLength;              //bytes of the name, no nul
+        long nStartBlock;                //where the directory block is on disk
+    } __attribute__((packed)) directories[];    //There is an array of these, as many as fit in one block
+} __attribute__((packed));
+
+#define MAX_DIRS_IN_ROOT(disk) \
+    (((disk)->block_size - sizeof(int) - DIRECTORY_TRAILER_SIZE) / sizeof(struct cs1550_directory))
+
+/*
+ * The root and every directory can span more than one block. The last bytes of each of their blocks link it to the
+ * other blocks of the same directory. The blocks are kept packed: every block but the last is full.
+ *
+ * A block of all zeros is a directory of one block, so new directories need nothing filled in but their attributes.
+ */
+struct cs1550_directory_chain {
+    long nNext;    //next block of the directory, 0 in the last one
+    long nPrev;    //previous block; in the first block, the last one, 0 if the first is the only one
+    long nHead;    //first block of the directory, 0 in the first block itself
+} __attribute__((packed));
+
+#define DIRECTORY_CHAIN(disk, block) \
+    ((struct cs1550_directory_chain *) ((char *) (block) + (disk)->block_size - sizeof(struct cs1550_directory_chain)))
+
+/*
+ * The names of a directory's entries (the root's included) live in name blocks of their own, so the entries stay the
+ * same size whatever the length of their name. A name never spans two blocks. New names are added at the end of the
+ * directory's current name block, which nNameBlock in front of the chain of its first block points at; a name block
+ * is freed once none of its names are in use, and the current one starts over instead.
+ */
+struct cs1550_name_block {
+    int nLive;     //bytes of names still in use
+    int nUsed;     //bytes handed out so far, from the start of names
+    char names[];
+} __attribute__((packed));
+
+struct cs1550_directory_names {
+    long nNameBlock;    //name block new names go in, 0 if there is none yet; only in the first block
+} __attribute__((packed));
+
+#define DIRECTORY_NAMES(disk, block) \
+    ((struct cs1550_directory_names *) ((char *) DIRECTORY_CHAIN(disk, block) - sizeof(struct cs1550_directory_names)))
+
+/*
+ * Every directory and file keeps its inode number and times. A directory's (the root's included) are in front of the
+ * cs1550_directory_names of its first block. A file's are in an array in front of those, with room for as many as the
+ * block has entries; they go wherever the entry goes.
+ */
+struct cs1550_attributes {
+    uint64_t nInode;    //inode number, the root's is 1; never handed to anything else while this is there
+    int64_t mtime;      //when the contents last changed, in seconds since the epoch
+    int64_t ctime;      //when the contents or the entry last changed
+} __attribute__((packed));
+
+//bytes at the end of every directory block that aren't entries; only the first block uses more than the chain
+#define DIRECTORY_TRAILER_SIZE \
+    (sizeof(struct cs1550_directory_chain) + sizeof(struct cs1550_directory_names) + sizeof(struct cs1550_attributes))
+
+#define DIRECTORY_ATTRIBUTES(disk, block) \
+    ((struct cs1550_attributes *) ((char *) DIRECTORY_NAMES(disk, block) - sizeof(struct cs1550_attributes)))
+
+//the attributes of entry index of a directory block
+#define FILE_ATTRIBUTES(disk, block, index) \
+    ((struct cs1550_attributes *) ((char *) DIRECTORY_ATTRIBUTES(disk, block) - \
+                                   MAX_FILES_IN_DIR(disk) * sizeof(struct cs1550_attributes)) + (index))
+
+
+//where a name is: the name block and the offset of the name in it
+#define NAME_LOCATION(block, offset) ((uint64_t) (block) << 16 | (uint64_t) (offset))
+#define NAME_BLOCK(location) ((long) ((location) >> 16))
+#define NAME_OFFSET(location) ((int) ((location) & 0xffff))
+
+//room for names in one name block
+#define MAX_NAME_BYTES(disk) ((disk)->block_size - sizeof(struct cs1550_name_block))
+
+//FNV-1a over a name, as kept in nameHash
+static inline uint32_t NAME_HASH(const char *name, int length) {
+    uint32_t hash = 2166136261u;
+    int i;
+
+    for (i = 0; i < length; ++i) {
+        hash = (hash ^ (uint8_t) name[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+
+typedef struct cs1550_directory_entry cs1550_directory_entry;
+
+// a file's first extent lives in its directory entry; any further ones live in a chain of these
+struct cs1550_extent_block {
+    long nNext;       //next block of extents, 0 if this is the last
+    int nExtents;     //How many extents are used in this block
+
+    struct cs1550_extent {
+        long nStartBlock;    //first block of the extent
+        long nBlocks;        //how many blocks in a row
+    } __attribute__((packed)) extents[];    //as many as fit in one block
+} __attribute__((packed));
+
+typedef struct cs1550_extent_block cs1550_extent_block;
+
+//How many extents fit in one extent block?
+#define MAX_EXTENTS_IN_BLOCK(disk) (((disk)->block_size - sizeof(long) - sizeof(int)) / sizeof(struct cs1550_extent))
+
+#define CS1550_MAGIC 0x30353531    // "1550"
+#define CS1550_VERSION 1           //the only layout there is; anything else isn't mounted
+
+//blocks set aside for the metadata journal when an image is formatted, header included
+#define DEFAULT_JOURNAL_BLOCKS 64
+
+/*
+ * Block 0 of every image. It records the geometry the image was formatted with, so one build can mount images of
+ * any size and block size:
+ *
+ *      block 0                             superblock
+ *      blocks bitmap_start ...             bitmap, one bit per block of the image
+ *      block root_block                    root directory
+ *      blocks journal_start ...            metadata journal, if journal_blocks isn't 0
+ *      blocks dir_pool_next ...            directory blocks handed out by mkdir before it touches the bitmap
+ *      everything after                    directory, extent and data blocks
+ */
+struct cs1550_superblock {
+    uint32_t magic;            //CS1550_MAGIC
+    uint32_t version;          //CS1550_VERSION
+    uint32_t block_size;       //bytes per block, a power of two
+    uint32_t reserved;
+    uint64_t block_count;      //blocks in the image, superblock included
+    uint64_t bitmap_start;     //first block of the bitmap
+    uint64_t bitmap_blocks;    //how many blocks the bitmap takes
+    uint64_t root_block;       //block holding the root directory
+    uint64_t dir_pool_next;    //next unused block of the preallocated directory pool
+    uint64_t dir_pool_end;     //one past the last block of the pool; equal to dir_pool_next once it's used up
+    uint64_t journal_start;    //header block of the journal
+    uint64_t journal_blocks;   //blocks in the journal, header included; 0 if there is none
+};
+
+#define CS1550_JOURNAL_MAGIC 0x4c4e524a       // "JRNL"
+#define CS1550_DESCRIPTOR_MAGIC 0x43534544    // "DESC"
+#define CS1550_COMMIT_MAGIC 0x54494d43        // "CMIT"
+
+/*
+ * The journal is a header block followed by a ring of blocks that transactions are appended to. A transaction is
+ *
+ *      descriptor, copies of the blocks it names, descriptor, copies, ..., commit
+ *
+ * and only counts once its commit block is there with the right sequence number and checksum. The ring is used
+ * from the front again once every block logged in it has reached its home, at which point the header moves on to
+ * the next sequence number; recovery replays transactions from the front of the ring for as long as the sequence
+ * numbers follow on from the header's.
+ */
+struct cs1550_journal_header {
+    uint32_t magic;            //CS1550_JOURNAL_MAGIC
+    uint32_t reserved;
+    uint64_t sequence;         //sequence number of the transaction at the front of the ring
+};
+
+struct cs1550_journal_descriptor {
+    uint32_t magic;            //CS1550_DESCRIPTOR_MAGIC
+    uint32_t count;            //how many block copies follow
+    uint64_t sequence;         //transaction this belongs to
+    uint64_t home[];           //where each copy goes, as many as fit in one block
+};
+
+struct cs1550_journal_commit {
+    uint32_t magic;            //CS1550_COMMIT_MAGIC
+    uint32_t blocks;           //blocks in the transaction before this one
+    uint64_t sequence;
+    uint64_t checksum;         //journal_checksum() of those blocks
+};
+
+//How many block numbers fit in one descriptor?
+#define HOMES_PER_DESCRIPTOR(block_size) \
+        (((block_size) - sizeof(struct cs1550_journal_descriptor)) / sizeof(uint64_t))
+
+#define JOURNAL_CHECKSUM_SEED 0xcbf29ce484222325ULL
+
+/**
+ * FNV-1a over the blocks of a transaction, carried on from the checksum of the blocks before; the first call starts
+ * from JOURNAL_CHECKSUM_SEED.
+ */
+static inline uint64_t journal_checksum(uint64_t checksum, const void *data, size_t length) {
+    const unsigned char *p = (const unsigned char *) data;
+    size_t i;
+
+    for (i = 0; i < length; ++i) {
+        checksum = (checksum ^ p[i]) * 0x100000001b3ULL;
+    }
+
+    return checksum;
+}
+
+/**
+ * Works out where everything goes on an image of size bytes, without touching the image.
+ *
+ * @param size bytes in the image
+ * @param block_size bytes per block
+ * @param directories how many directory blocks to set aside after the root and journal
+ * @param journal_blocks how many blocks the journal gets, header included; 0 for none, else at least 3
+ * @param super filled in with the layout
+ * @return EXIT_SUCCESS
+ *      -EINVAL if the block size isn't a power of two in [MIN_BLOCK_SIZE, MAX_BLOCK_SIZE], or the journal can't hold
+ *          a single transaction
+ *      -ENOSPC if the image is too small to hold the superblock, bitmap, root, journal, pool and at least one more
+ *          block
+ */
+static inline int layout_disk(off_t size, size_t block_size, long directories, long journal_blocks,
+                              struct cs1550_superblock *super) {
+    if (block_size < MIN_BLOCK_SIZE || block_size > MAX_BLOCK_SIZE || (block_size & (block_size - 1)) != 0 ||
+        directories < 0 || journal_blocks < 0 || (journal_blocks > 0 && journal_blocks < 3)) {
+        return -EINVAL;
+    }
+
+    memset(super, 0, sizeof(struct cs1550_superblock));
+    super->magic = CS1550_MAGIC;
+    super->version = CS1550_VERSION;
+    super->block_size = (uint32_t) block_size;
+    super->block_count = (uint64_t) size / block_size;
+
+    // one bit per block, rounded up to whole blocks
+    uint64_t bits_per_block = (uint64_t) block_size * 8;
+    super->bitmap_start = 1;
+    super->bitmap_blocks = (super->block_count + bits_per_block - 1) / bits_per_block;
+    super->root_block = super->bitmap_start + super->bitmap_blocks;
+    super->journal_start = journal_blocks > 0 ? super->root_block + 1 : 0;
+    super->journal_blocks = (uint64_t) journal_blocks;
+    super->dir_pool_next = super->root_block + 1 + super->journal_blocks;
+    super->dir_pool_end = super->dir_pool_next + (uint64_t) directories;
+
+    if (super->dir_pool_end >= super->block_count) {
+        return -ENOSPC;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ *
+ * @return how many blocks at the front of the image format_metadata() fills in: everything up to the root, or up to
+ *      the journal header if there is a journal
+ */
+static inline uint64_t metadata_blocks(const struct cs1550_superblock *super) {
+    return super->journal_blocks > 0 ? super->journal_start + 1 : super->root_block + 1;
+}
+
+/**
+ * Lays down the metadata of an empty image: the superblock, a bitmap with everything up to the end of the directory
+ * pool marked used, an empty root made at time now and an empty journal. The rest of the journal and the pool blocks
+ * aren't touched; nothing in the ring counts without the header's sequence number, and an all-zero block already is
+ * an empty directory apart from its attributes.
+ *
+ * @param metadata the first metadata_blocks() blocks of the image
+ * @param super the layout from layout_disk()
+ * @param now the root's times
+ */
+static inline void format_metadata(char *metadata, const struct cs1550_superblock *super, time_t now) {
+    memset(metadata, 0, metadata_blocks(super) * super->block_size);
+    memcpy(metadata, super, sizeof(struct cs1550_superblock));
+
+    if (super->journal_blocks > 0) {
+        struct cs1550_journal_header *header =
+                (struct cs1550_journal_header *) (metadata + super->journal_start * super->block_size);
+        header->magic = CS1550_JOURNAL_MAGIC;
+        header->sequence = 1;
+    }
+
+    // the root's attributes sit where DIRECTORY_ATTRIBUTES() finds them, in front of the chain and names
+    struct cs1550_attributes *root = (struct cs1550_attributes *) (metadata + (super->root_block + 1) *
+                                                                   super->block_size - DIRECTORY_TRAILER_SIZE);
+    root->nInode = 1;
+    root->mtime = root->ctime = now;
+
+    unsigned char *bitmap = (unsigned char *) metadata + super->bitmap_start * super->block_size;
+    uint64_t used = super->dir_pool_end;
+    memset(bitmap, 0xFF, used / 8);
+    if (used % 8 != 0) {
+        bitmap[used / 8] = (unsigned char) ((1 << (used % 8)) - 1);
+    }
+}
+
+#endif //CS1550_H
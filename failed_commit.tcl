@@ -0,0 +1,101 @@
+#! /usr/bin/env expect
+
+proc failed_commit {directory} {
+
+    global env
+
+# needs cs1550_faults, the build that refuses the first CS1550_FAIL_WRITES writes
+# to the image, so it takes the mount over and gives it back to ./cs1550 after
+    cd [file dirname $directory]
+
+    if { [catch {set result [exec fusermount -u $directory]} reason] } {
+
+    puts "Failed execution: $reason"
+
+    }
+
+    set env(CS1550_FAIL_WRITES) 1
+
+    if { [catch {set result [exec ./cs1550_faults $directory]} reason] } {
+
+    puts "Failed execution: $reason"
+
+    }
+
+    unset env(CS1550_FAIL_WRITES)
+
+    cd $directory
+
+    if { [catch {set result [exec {*}[eval list {mkdir "commit"}]]} reason] } {
+
+    puts "Failed execution: $reason"
+
+    }
+
+    cd "commit"
+
+# the commit 'first.txt' waits for fails; the one 'second.txt' waits for has
+# to write both, or 'first.txt' is gone once the mount is killed
+    puts "\nExecuting: write 'first.txt' and wait for a commit that fails\n"
+
+    if { [catch {set result [exec sh -c "echo first > first.txt && dd if=/dev/null of=first.txt conv=notrunc,fsync 2>/dev/null"]} reason] } {
+
+    puts "fsync of 'first.txt' failed, as it should"
+
+    } else {
+
+    puts "Failed: fsync of 'first.txt' went through"
+
+    }
+
+    puts "\nExecuting: write 'second.txt' and wait for the next commit\n"
+
+    if { [catch {set result [exec sh -c "echo second > second.txt && dd if=/dev/null of=second.txt conv=notrunc,fsync 2>/dev/null"]} reason] } {
+
+    puts "Failed execution: $reason"
+
+    }
+
+    cd {..}
+
+    cd {..}
+
+    puts "\nExecuting: kill -9 the mount and mount it again\n"
+
+    if { [catch {set result [exec pkill -9 -f "cs1550_faults $directory"]} reason] } {
+
+    puts "Failed execution: $reason"
+
+    }
+
+    after 500
+
+    if { [catch {set result [exec fusermount -u $directory]} reason] } {
+
+    puts "Failed execution: $reason"
+
+    }
+
+    if { [catch {set result [exec ./cs1550 $directory]} reason] } {
+
+    puts "Failed execution: $reason"
+
+    }
+
+    foreach {name contents} {first.txt first second.txt second} {
+
+        if { [catch {set result [exec cat $directory/commit/$name]} reason] } {
+
+        puts "Failed execution: $reason"
+
+        } elseif { $result ne $contents } {
+
+        puts "Failed: '$name' reads back '$result', wrote '$contents'"
+
+        } else {
+
+        puts "'$name' survived"
+
+        }
+    }
+}
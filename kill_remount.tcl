@@ -0,0 +1,115 @@
+#! /usr/bin/env expect
+
+proc kill_remount {directory} {
+
+    cd $directory
+
+    if { [catch {set result  [exec {*}[eval list {pwd}]]} reason] } {
+
+    puts "Failed execution: $reason"
+
+    } else {
+
+    puts $result
+
+    }
+
+    if { [catch {set result [exec {*}[eval list {mkdir "crash"}]]} reason] } {
+
+    puts "Failed execution: $reason"
+
+    }
+
+    if { [catch {set result [exec {*}[eval list {mkdir "crash/inner"}]]} reason] } {
+
+    puts "Failed execution: $reason"
+
+    }
+
+    cd "crash"
+
+# everything fsync has returned for must be there after the mount is killed;
+# recovery replays whatever the journal holds that the image doesn't yet
+    puts "\nExecuting: write files and fsync them\n"
+
+    set test_args {
+        {sh -c "echo one > one.txt && dd if=/dev/null of=one.txt conv=notrunc,fsync 2>/dev/null"}
+        {sh -c "echo two > inner/two.txt && dd if=/dev/null of=inner/two.txt conv=notrunc,fsync 2>/dev/null"}
+        {sh -c "dd if=/dev/urandom of=big.bin bs=4096 count=64 conv=fsync 2>/dev/null"}
+    }
+
+    foreach test $test_args {
+        puts "Executing: $test"
+
+        if { [catch {set result [exec {*}[eval list $test]]} reason] } {
+
+        puts "Failed execution: $reason"
+
+        }
+    }
+
+    if { [catch {set before [exec cksum big.bin]} reason] } {
+
+    puts "Failed execution: $reason"
+
+    set before {}
+
+    }
+
+    cd {..}
+
+    cd {..}
+
+    puts "\nExecuting: kill -9 the mount and mount it again\n"
+
+    if { [catch {set result [exec pkill -9 -x cs1550]} reason] } {
+
+    puts "Failed execution: $reason"
+
+    }
+
+    after 500
+
+    if { [catch {set result [exec fusermount -u $directory]} reason] } {
+
+    puts "Failed execution: $reason"
+
+    }
+
+    if { [catch {set result [exec ./cs1550 $directory]} reason] } {
+
+    puts "Failed execution: $reason"
+
+    }
+
+    foreach {name contents} {one.txt one inner/two.txt two} {
+
+        if { [catch {set result [exec cat $directory/crash/$name]} reason] } {
+
+        puts "Failed execution: $reason"
+
+        } elseif { $result ne $contents } {
+
+        puts "Failed: '$name' reads back '$result', wrote '$contents'"
+
+        } else {
+
+        puts "'$name' survived"
+
+        }
+    }
+
+    if { [catch {set result [exec cksum $directory/crash/big.bin]} reason] } {
+
+    puts "Failed execution: $reason"
+
+    } elseif { [lrange $result 0 1] ne [lrange $before 0 1] } {
+
+    puts "Failed: 'big.bin' doesn't match the checksum taken before the kill"
+
+    } else {
+
+    puts "'big.bin' survived"
+
+    }
+}
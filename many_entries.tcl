@@ -0,0 +1,89 @@
+#! /usr/bin/env expect
+
+proc many_entries {directory} {
+
+    cd $directory
+
+    if { [catch {set result  [exec {*}[eval list {pwd}]]} reason] } {
+
+    puts "Failed execution: $reason"
+
+    } else {
+
+    puts $result
+
+    }
+
+    if { [catch {set result [exec {*}[eval list {mkdir "many"}]]} reason] } {
+
+    puts "Failed execution: $reason"
+
+    }
+
+    cd "many"
+
+# far more entries than one directory block holds, so the directory has to
+# grow a chain of blocks; empty files take no data blocks of their own
+    set count 3000
+
+    puts "\nExecuting: create $count files in one directory\n"
+
+    if { [catch {set result [exec sh -c "i=0; while \[ \$i -lt $count \]; do : > file\$i.txt || exit 1; i=\$((i + 1)); done"]} reason] } {
+
+    puts "Failed execution: $reason"
+
+    }
+
+    if { [catch {set result [exec sh -c "ls | wc -l"]} reason] } {
+
+    puts "Failed execution: $reason"
+
+    } elseif { [string trim $result] != $count } {
+
+    puts "Failed: ls lists [string trim $result] entries, created $count"
+
+    } else {
+
+    puts "ls lists all $count entries"
+
+    }
+
+    foreach name [list file0.txt file[expr {$count / 2}].txt file[expr {$count - 1}].txt] {
+
+        if { [catch {set result [exec ls $name]} reason] } {
+
+        puts "Failed execution: $reason"
+
+        } else {
+
+        puts $result
+
+        }
+    }
+
+    puts "\nExecuting: remove the $count files\n"
+
+    if { [catch {set result [exec sh -c "i=0; while \[ \$i -lt $count \]; do rm file\$i.txt || exit 1; i=\$((i + 1)); done"]} reason] } {
+
+    puts "Failed execution: $reason"
+
+    }
+
+    if { [catch {set result  [exec {*}[eval list {ls}]]} reason] } {
+
+    puts "Failed execution: $reason"
+
+    } else {
+
+    puts "left after removing them: '$result'"
+
+    }
+
+    cd {..}
+
+    if { [catch {set result [exec {*}[eval list {rmdir "many"}]]} reason] } {
+
+    puts "Failed execution: $reason"
+
+    }
+}
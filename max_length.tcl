@@ -24,10 +24,22 @@ proc max_length {directory} {
 
     }
 
-    set test_args {{mkdir {f0000000}}
-        {mkdir {f00000000}}
+# a name can be up to 255 bytes long, directory or file; a 256 byte one is
+# refused with 'File name too long'
+    set dir_255 [string repeat "d" 255]
+    set dir_256 [string repeat "d" 256]
+    set file_255 [string repeat "f" 251].txt
+    set file_256 [string repeat "f" 252].txt
+
+    puts "\nExecuting: make entries with 255 and 256 byte names\n"
+
+    set test_args [list [list mkdir $dir_255] \
+        [list mkdir $dir_256] \
+        [list cp /dev/null $dir_255/$file_255] \
+        [list cp /dev/null $dir_255/$file_256] \
+        [list ls $dir_255] \
         {ls}
-    }
+    ]
 
     foreach test $test_args {
         puts "Executing: $test"
@@ -0,0 +1,204 @@
+/*
+    mkfs.cs1550: creates an empty cs1550 image.
+
+    usage: mkfs.cs1550 [-s size] [-b block size] [-d directories] [-j journal blocks] image
+
+    Edited by Betsalel "Saul" Williamson
+    saul.williamson@pitt.edu
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+
+#include "cs1550.h"
+
+//what the test scripts have always used
+#define DEFAULT_DISK_SIZE (5L * 1024 * 1024)
+
+/**
+ * Reads a size such as 5242880, 5M or 2G.
+ *
+ * @param text the size
+ * @param size set to the size in bytes
+ * @return EXIT_SUCCESS
+ *      -EINVAL if text isn't a size, or one too big to hold
+ */
+static int parse_size(const char *text, off_t *size) {
+    char *end;
+    long long multiplier = 1;
+
+    errno = 0;
+    long long value = strtoll(text, &end, 10);
+
+    if (end == text || value <= 0 || errno == ERANGE) {
+        return -EINVAL;
+    }
+
+    switch (*end) {
+        case 'k':
+        case 'K':
+            multiplier = 1024;
+            end++;
+            break;
+        case 'm':
+        case 'M':
+            multiplier = 1024 * 1024;
+            end++;
+            break;
+        case 'g':
+        case 'G':
+            multiplier = 1024 * 1024 * 1024;
+            end++;
+            break;
+        default:
+            break;
+    }
+
+    if (*end != '\0' || value > LLONG_MAX / multiplier) {
+        return -EINVAL;
+    }
+
+    *size = (off_t) (value * multiplier);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Reads a plain decimal number such as 4096.
+ *
+ * @param text the number
+ * @param number set to the number
+ * @return EXIT_SUCCESS
+ *      -EINVAL if text isn't a whole number or has anything after it
+ */
+static int parse_number(const char *text, long *number) {
+    char *end;
+    errno = 0;
+    long long value = strtoll(text, &end, 10);
+
+    if (end == text || *end != '\0' || errno == ERANGE || value < 0 || value > LONG_MAX) {
+        return -EINVAL;
+    }
+
+    *number = (long) value;
+    return EXIT_SUCCESS;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-s size] [-b block size] [-d directories] [-j journal blocks] image\n"
+                    "    -s size          image size in bytes, K, M or G (default 5M)\n"
+                    "    -b block size    power of two from %d to %d (default %d)\n"
+                    "    -d directories   directory blocks to preallocate (default 0)\n"
+                    "    -j blocks        metadata journal size, 0 for none, else at least 3 (default %d)\n"
+                    "    image            path of the image, e.g. .disk; replaced if it exists\n",
+            name, MIN_BLOCK_SIZE, MAX_BLOCK_SIZE, DEFAULT_BLOCK_SIZE, DEFAULT_JOURNAL_BLOCKS);
+}
+
+int main(int argc, char *argv[]) {
+    off_t size = DEFAULT_DISK_SIZE;
+    long block_size = DEFAULT_BLOCK_SIZE;
+    long directories = 0;
+    long journal_blocks = DEFAULT_JOURNAL_BLOCKS;
+    const char *disk_path;
+
+    int c;
+    while ((c = getopt(argc, argv, "s:b:d:j:h")) != -1) {
+        switch (c) {
+            case 's':
+                if (parse_size(optarg, &size) != EXIT_SUCCESS) {
+                    fprintf(stderr, "%s: bad size %s\n", argv[0], optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'b':
+                if (parse_number(optarg, &block_size) != EXIT_SUCCESS) {
+                    fprintf(stderr, "%s: bad block size %s\n", argv[0], optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'd':
+                if (parse_number(optarg, &directories) != EXIT_SUCCESS) {
+                    fprintf(stderr, "%s: bad directory count %s\n", argv[0], optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'j':
+                if (parse_number(optarg, &journal_blocks) != EXIT_SUCCESS) {
+                    fprintf(stderr, "%s: bad journal size %s\n", argv[0], optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    // no default image, so running it bare can't wipe whatever .disk is lying around
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    disk_path = argv[optind];
+
+    struct cs1550_superblock super;
+    int result = layout_disk(size, (size_t) block_size, directories, journal_blocks, &super);
+    if (result == -EINVAL) {
+        fprintf(stderr, "%s: block size must be a power of two from %d to %d, and a journal at least 3 blocks\n",
+                argv[0], MIN_BLOCK_SIZE, MAX_BLOCK_SIZE);
+        return EXIT_FAILURE;
+    } else if (result == -ENOSPC) {
+        fprintf(stderr, "%s: %lld bytes is too small for the metadata, journal and %ld directories\n", argv[0],
+                (long long) size, directories);
+        return EXIT_FAILURE;
+    }
+
+    int fd = open(disk_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        fprintf(stderr, "%s: can't open %s: %s\n", argv[0], disk_path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    // the file is empty after O_TRUNC, so every block reads back as zero without being written; reserve the space
+    // up front when the file system can, otherwise leave the image sparse
+    if (fallocate(fd, 0, 0, size) == -1 && ftruncate(fd, size) == -1) {
+        fprintf(stderr, "%s: can't size %s: %s\n", argv[0], disk_path, strerror(errno));
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    // superblock, bitmap, root and journal header are the only blocks that aren't zero
+    size_t length = (size_t) (metadata_blocks(&super) * super.block_size);
+    char *metadata = malloc(length);
+    if (metadata == NULL) {
+        fprintf(stderr, "%s: can't format %s: %s\n", argv[0], disk_path, strerror(ENOMEM));
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    format_metadata(metadata, &super, time(NULL));
+
+    if (pwrite(fd, metadata, length, 0) != (ssize_t) length || fsync(fd) == -1) {
+        fprintf(stderr, "%s: can't write %s: %s\n", argv[0], disk_path, strerror(errno));
+        free(metadata);
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    free(metadata);
+    close(fd);
+
+    printf("%s: %llu blocks of %u bytes, bitmap %llu blocks, root at %llu, journal %llu blocks, "
+           "%ld directories preallocated\n",
+           disk_path, (unsigned long long) super.block_count, super.block_size,
+           (unsigned long long) super.bitmap_blocks, (unsigned long long) super.root_block,
+           (unsigned long long) super.journal_blocks, directories);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,86 @@
+#! /usr/bin/env expect
+
+proc nested_directories {directory} {
+
+    cd $directory
+
+    if { [catch {set result  [exec {*}[eval list {pwd}]]} reason] } {
+
+    puts "Failed execution: $reason"
+
+    } else {
+
+    puts $result
+
+    }
+
+# a chain of directories, each inside the last, with a file at the bottom
+    set depth 16
+    set path "n01"
+    for {set i 2} {$i <= $depth} {incr i} {
+        set path [format "%s/n%02d" $path $i]
+    }
+
+    puts "\nExecuting: make $depth nested directories and a file at the bottom\n"
+
+    set test_args [list [list mkdir -p $path] \
+        [list cp /dev/null $path/deep.txt] \
+        [list ls $path] \
+        {ls n01}
+    ]
+
+    foreach test $test_args {
+        puts "Executing: $test"
+
+        if { [catch {set result [exec {*}[eval list $test]]} reason] } {
+
+        puts "Failed execution: $reason"
+
+        } else {
+
+        puts $result
+
+        }
+    }
+
+# a directory that still holds something can't be removed; from the bottom up
+# each one is empty by the time its turn comes
+    puts "\nExecuting: remove the nested directories\n"
+
+    if { [catch {set result [exec rmdir n01]} reason] } {
+
+    puts "rmdir n01 failed, as it should: $reason"
+
+    } else {
+
+    puts "Failed: rmdir n01 removed a directory that isn't empty"
+
+    }
+
+    if { [catch {set result [exec rm $path/deep.txt]} reason] } {
+
+    puts "Failed execution: $reason"
+
+    }
+
+    for {set i $depth} {$i >= 1} {incr i -1} {
+
+        if { [catch {set result [exec rmdir $path]} reason] } {
+
+        puts "Failed execution: $reason"
+
+        }
+
+        set path [file dirname $path]
+    }
+
+    if { [catch {set result  [exec {*}[eval list {ls}]]} reason] } {
+
+    puts "Failed execution: $reason"
+
+    } else {
+
+    puts "left after removing them: '$result'"
+
+    }
+}
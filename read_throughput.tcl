@@ -0,0 +1,85 @@
+#! /usr/bin/env expect
+
+proc read_throughput {directory} {
+
+    cd $directory
+
+    if { [catch {set result  [exec {*}[eval list {pwd}]]} reason] } {
+
+    puts "Failed execution: $reason"
+
+    } else {
+
+    puts $result
+
+    }
+
+    if { [catch {set result [exec {*}[eval list {mkdir "bench"}]]} reason] } {
+
+    puts "Failed execution: $reason"
+
+    } else {
+
+    puts $result
+
+    }
+
+    cd "bench"
+
+# 3 MB fits on the 5 MB test disk next to the bitmap
+    set file_size [expr {3 * 1024 * 1024}]
+
+    puts "\nExecuting: write [expr {$file_size / 1024}] KB file 'big.bin'\n"
+
+# keep a checksum of what went in so every read can be checked against it, not only timed
+    set written ""
+
+    if { [catch {set result [exec dd if=/dev/urandom bs=4k count=[expr {$file_size / 4096}] 2>/dev/null | tee big.bin | md5sum]} reason] } {
+
+    puts "Failed execution: $reason"
+
+    } else {
+
+    set written [lindex $result 0]
+    puts "md5 of written data: $written"
+
+    }
+
+# read it back front to back in the chunk sizes the kernel uses for readahead
+# mount with -o direct_io to keep the kernel page cache out of the numbers
+    foreach block_size {4k 128k} {
+        puts "\nExecuting: sequential read of 'big.bin' with bs=$block_size\n"
+
+        set start [clock microseconds]
+
+        if { [catch {set result [exec dd if=big.bin of=/dev/null bs=$block_size 2>@1]} reason] } {
+
+        puts "Failed execution: $reason"
+
+        } else {
+
+        set elapsed [expr {max([clock microseconds] - $start, 1)}]
+        puts $result
+        puts [format "bs=%s: %.1f MB/s" $block_size [expr {$file_size / 1048576.0 / ($elapsed / 1000000.0)}]]
+
+        }
+
+        if { [catch {set result [exec dd if=big.bin bs=$block_size 2>/dev/null | md5sum]} reason] } {
+
+        puts "Failed execution: $reason"
+
+        } elseif { [lindex $result 0] ne $written } {
+
+        puts "Failed: bs=$block_size read back [lindex $result 0], wrote $written"
+
+        } else {
+
+        puts "bs=$block_size: read back matches"
+
+        }
+    }
+
+    cd {..}
+
+    cd {..}
+}
@@ -41,13 +41,21 @@ set ip "$server.cs.pitt.edu"
 
 # upload the files to the server
 spawn ./upload.tcl cs1550.c /u/OSLab/bhw7/fuse-2.7.0/example
+spawn ./upload.tcl cs1550.h /u/OSLab/bhw7/fuse-2.7.0/example
+spawn ./upload.tcl mkfs.cs1550.c /u/OSLab/bhw7/fuse-2.7.0/example
 spawn ./upload.tcl test.tcl /u/OSLab/bhw7/fuse-2.7.0/example
 spawn ./upload.tcl tests.tcl /u/OSLab/bhw7/fuse-2.7.0/example
 spawn ./upload.tcl clean_disk.tcl /u/OSLab/bhw7/fuse-2.7.0/example
 spawn ./upload.tcl create_directories.tcl /u/OSLab/bhw7/fuse-2.7.0/example
 spawn ./upload.tcl create_files.tcl /u/OSLab/bhw7/fuse-2.7.0/example
 spawn ./upload.tcl max_length.tcl /u/OSLab/bhw7/fuse-2.7.0/example
+spawn ./upload.tcl read_throughput.tcl /u/OSLab/bhw7/fuse-2.7.0/example
+spawn ./upload.tcl churn.tcl /u/OSLab/bhw7/fuse-2.7.0/example
 spawn ./upload.tcl close.tcl /u/OSLab/bhw7/fuse-2.7.0/example
+spawn ./upload.tcl failed_commit.tcl /u/OSLab/bhw7/fuse-2.7.0/example
+spawn ./upload.tcl nested_directories.tcl /u/OSLab/bhw7/fuse-2.7.0/example
+spawn ./upload.tcl many_entries.tcl /u/OSLab/bhw7/fuse-2.7.0/example
+spawn ./upload.tcl kill_remount.tcl /u/OSLab/bhw7/fuse-2.7.0/example
 
 #spawn sh -c {osascript -e "tell application \"Terminal\"" -e "tell application \"System Events\" to keystroke \"t\" using {command down}" -e "do script \"cd $PWD; clear\" in front window" -e "end tell" > /dev/null}
 
@@ -70,6 +78,12 @@ expect \
 expect \
     "$server" { send "make\r" }
 
+expect \
+    "$server" { send "gcc -Wall -o mkfs.cs1550 mkfs.cs1550.c\r" }
+
+expect \
+    "$server" { send "gcc -Wall -D_FILE_OFFSET_BITS=64 -DCS1550_FAULTS -I../include -o cs1550_faults cs1550.c ../lib/.libs/libfuse.a -lpthread -lrt -ldl\r" }
+
 expect \
     "$server" { send "./cs1550 -d $directory\r" }
 
@@ -73,9 +73,9 @@ proc clean_disk {} {
 
     }
 
-    if { [catch {set result [exec dd bs=1K count=5K if=/dev/zero of=.disk]} reason] } {
+    if { [catch {set result [exec ./mkfs.cs1550 -s 5M .disk]} reason] } {
 
-    puts "Failed exec dd bs=1K count=5K if=/dev/zero of=.disk:\n$reason"
+    puts "Failed exec ./mkfs.cs1550 -s 5M .disk:\n$reason"
 #    exit -2
 
     } else {
@@ -106,4 +106,40 @@ clean_disk
 create_files $directory
 puts "\n****************************************\n"
 
+puts "read_throughput test\n"
+clean_disk
+# sequential read benchmark
+read_throughput $directory
+puts "\n****************************************\n"
+
+puts "churn test\n"
+clean_disk
+# create and delete files until the disk has been filled several times over
+churn $directory
+puts "\n****************************************\n"
+
+puts "failed_commit test\n"
+clean_disk
+# a commit that fails leaves its blocks for the next one
+failed_commit $directory
+puts "\n****************************************\n"
+
+puts "nested_directories test\n"
+clean_disk
+# directories inside directories, removed from the bottom up
+nested_directories $directory
+puts "\n****************************************\n"
+
+puts "many_entries test\n"
+clean_disk
+# thousands of files in one directory, past what a single block holds
+many_entries $directory
+puts "\n****************************************\n"
+
+puts "kill_remount test\n"
+clean_disk
+# whatever fsync returned for is still there after kill -9 and a remount
+kill_remount $directory
+puts "\n****************************************\n"
+
 interact
@@ -2,4 +2,10 @@
 
 source [file join [file dirname [info script]] create_files.tcl]
 source [file join [file dirname [info script]] max_length.tcl]
-source [file join [file dirname [info script]] create_directories.tcl]
\ No newline at end of file
+source [file join [file dirname [info script]] create_directories.tcl]
+source [file join [file dirname [info script]] read_throughput.tcl]
+source [file join [file dirname [info script]] churn.tcl]
+source [file join [file dirname [info script]] failed_commit.tcl]
+source [file join [file dirname [info script]] nested_directories.tcl]
+source [file join [file dirname [info script]] many_entries.tcl]
+source [file join [file dirname [info script]] kill_remount.tcl]
\ No newline at end of file